@@ -0,0 +1,155 @@
+/* startup time with and without the scan cache, on a synthetic tree
+ * usage: bench_cache [-d depth] [-f fanout] [-n files per dir] [-t threads] [-r repeat]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fstree.h"
+#include "scan.h"
+#include "cache.h"
+#include "benchutil.h"
+
+static double cold_start(const char *path, const char *cache_fname);
+static double warm_start(const char *cache_fname, const char *path, double *load_sec);
+static void touch_chain(const char *path, int depth);
+
+int main(int argc, char **argv)
+{
+	int depth = 4, fanout = 8, num_files = 20, repeat = 5;
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][2] == 0 && i < argc - 1) {
+			int val = atoi(argv[++i]);
+			switch(argv[i - 1][1]) {
+			case 'd': depth = val; break;
+			case 'f': fanout = val; break;
+			case 'n': num_files = val; break;
+			case 't': set_scan_threads(val); break;
+			case 'r': repeat = val; break;
+			default:
+				fprintf(stderr, "invalid option: %s\n", argv[i - 1]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-d depth] [-f fanout] [-n files] [-t threads] [-r repeat]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	char path[PATH_MAX], cache_fname[PATH_MAX];
+	if(snprintf(path, sizeof path, "%s/fsnav-bench-%d", bench_scratch_dir(), (int)getpid()) >= (int)sizeof path ||
+			snprintf(cache_fname, sizeof cache_fname, "%s.cache", path) >= (int)sizeof cache_fname) {
+		fprintf(stderr, "scratch directory path too long: %s\n", bench_scratch_dir());
+		return 1;
+	}
+
+	printf("generating tree: depth %d, fanout %d, %d files per dir in %s\n", depth, fanout, num_files, path);
+	double t0 = get_time_sec();
+	long num_ent = gen_tree(path, depth, fanout, num_files);
+	if(num_ent < 0) {
+		remove_tree(path);
+		return 1;
+	}
+	printf("  %ld entries in %.2f sec\n", num_ent, get_time_sec() - t0);
+	printf("startup with %d threads, best of %d\n", get_scan_threads(), repeat);
+
+	double best_cold = -1.0, best_warm = -1.0, best_load = -1.0, best_changed = -1.0;
+
+	for(int i=0; i<repeat; i++) {
+		double sec = cold_start(path, cache_fname);
+		if(sec < 0.0) {
+			goto end;
+		}
+		if(best_cold < 0.0 || sec < best_cold) {
+			best_cold = sec;
+		}
+
+		double load_sec;
+		if((sec = warm_start(cache_fname, path, &load_sec)) < 0.0) {
+			goto end;
+		}
+		if(best_warm < 0.0 || sec < best_warm) {
+			best_warm = sec;
+			best_load = load_sec;
+		}
+
+		// one new file in a directory on every level
+		touch_chain(path, depth);
+		if((sec = warm_start(cache_fname, path, &load_sec)) < 0.0) {
+			goto end;
+		}
+		if(best_changed < 0.0 || sec < best_changed) {
+			best_changed = sec;
+		}
+	}
+
+	printf("  cold (scan and save)    %8.2f ms\n", best_cold * 1000.0);
+	printf("  warm (load and check)   %8.2f ms  (load %.2f ms)\n", best_warm * 1000.0, best_load * 1000.0);
+	printf("  warm, %2d dirs changed   %8.2f ms\n", depth + 1, best_changed * 1000.0);
+
+end:
+	remove(cache_fname);
+	remove_tree(path);
+	return 0;
+}
+
+// what fsnav does at startup without a cache: scan everything, then save
+static double cold_start(const char *path, const char *cache_fname)
+{
+	Dir *tree = new Dir;
+
+	double t0 = get_time_sec();
+	if(!build_tree(tree, path) || !save_cache(tree, cache_fname)) {
+		delete tree;
+		return -1.0;
+	}
+	double sec = get_time_sec() - t0;
+
+	delete tree;
+	return sec;
+}
+
+// and with a cache: load it, and check every directory against the filesystem
+static double warm_start(const char *cache_fname, const char *path, double *load_sec)
+{
+	double t0 = get_time_sec();
+
+	Dir *tree = load_cache(cache_fname);
+	if(!tree) {
+		fprintf(stderr, "failed to load the cache\n");
+		return -1.0;
+	}
+	*load_sec = get_time_sec() - t0;
+
+	tree->set_name(path);
+	if(!refresh_tree(tree)) {
+		delete tree;
+		return -1.0;
+	}
+	double sec = get_time_sec() - t0;
+
+	delete tree;
+	return sec;
+}
+
+static void touch_chain(const char *path, int depth)
+{
+	static int count;
+	char buf[1024];
+
+	strcpy(buf, path);
+	for(int i=0; i<=depth; i++) {
+		size_t len = strlen(buf);
+		sprintf(buf + len, "/new%d", count);
+
+		int fd = open(buf, O_WRONLY | O_CREAT, 0644);
+		if(fd != -1) {
+			close(fd);
+		}
+		strcpy(buf + len, "/dir0");
+	}
+	count++;
+}
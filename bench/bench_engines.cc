@@ -0,0 +1,160 @@
+/* time of a full layout of a synthetic tree of about a million entries with
+ * each of the layout engines, on one thread and on all of them (or -t), the
+ * latter checked to put every node exactly where a single thread does. Also
+ * the time to lay out again after a file is added at the bottom of the tree,
+ * and how far the layout spreads out on the ground.
+ * usage: bench_engines [-d depth] [-f fanout] [-n files per dir] [-r repeat] [-t threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <float.h>
+#include <vector>
+#include "fstree.h"
+#include "scan.h"
+#include "benchutil.h"
+
+static double time_layout(Dir *tree, int repeat);
+static void get_positions(const Dir *dir, std::vector<Vector3> *pos);
+static void get_extent(const Dir *dir, Vector3 *min, Vector3 *max);
+
+int main(int argc, char **argv)
+{
+	int depth = 5, fanout = 8, num_files = 26, repeat = 3;
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][2] == 0 && i < argc - 1) {
+			int val = atoi(argv[++i]);
+			switch(argv[i - 1][1]) {
+			case 'd': depth = val; break;
+			case 'f': fanout = val; break;
+			case 'n': num_files = val; break;
+			case 'r': repeat = val; break;
+			case 't': max_threads = val; break;
+			default:
+				fprintf(stderr, "invalid option: %s\n", argv[i - 1]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-d depth] [-f fanout] [-n files] [-r repeat] [-t threads]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(max_threads < 1) {
+		max_threads = 1;
+	}
+
+	// same as fsnav
+	set_layout_param(LP_FILE_SIZE, 0.5);
+	set_layout_param(LP_FILE_SPACING, 0.1);
+	set_layout_param(LP_FILE_HEIGHT, 0.1);
+	set_layout_param(LP_FILE_MAX_HEIGHT, 2.0);
+	set_layout_param(LP_DIR_SIZE, 0.5 + 0.2);
+	set_layout_param(LP_DIR_SPACING, 0.5);
+	set_layout_param(LP_DIR_HEIGHT, 0.1);
+	set_layout_param(LP_DIR_DIST, 5.0);
+
+	printf("building tree in memory: depth %d, fanout %d, %d files per dir\n", depth, fanout, num_files);
+	Dir *tree = gen_mem_tree(depth, fanout, num_files);
+	calc_tree_stats(tree);	// layout goes by the aggregates
+
+	std::vector<Vector3> ref, pos;
+	get_positions(tree, &ref);
+	long num_ent = ref.size();
+	printf("  %ld entries, up to %d threads, best of %d\n", num_ent, max_threads, repeat);
+
+	// the last directory, to add files to
+	Dir *leaf = tree;
+	while(leaf->get_num_subdirs()) {
+		leaf = leaf->get_subdir(leaf->get_num_subdirs() - 1);
+	}
+
+	for(int i=0; i<NUM_LAYOUT_ENGINES; i++) {
+		LayoutEngine engine = (LayoutEngine)i;
+		set_layout_engine(engine);
+
+		set_scan_threads(1);
+		double single = time_layout(tree, repeat);
+		ref.clear();
+		get_positions(tree, &ref);
+
+		set_scan_threads(max_threads);
+		double multi = time_layout(tree, repeat);
+		pos.clear();
+		get_positions(tree, &pos);
+
+		bool same = pos.size() == ref.size();
+		for(size_t j=0; same && j<pos.size(); j++) {
+			same = pos[j].x == ref[j].x && pos[j].y == ref[j].y && pos[j].z == ref[j].z;
+		}
+
+		Vector3 min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		get_extent(tree, &min, &max);
+
+		double relayout = 1e9;
+		for(int j=0; j<repeat; j++) {
+			File *file = new_file(leaf->get_arena());
+			file->set_name("new");
+
+			double t0 = get_time_sec();
+			leaf->add_file(file);
+			leaf->relayout();
+			double sec = get_time_sec() - t0;
+			if(sec < relayout) relayout = sec;
+		}
+
+		printf("  %-8s %8.2f ms  (%.1f ns/entry), %d threads %8.2f ms%s\n",
+				get_layout_engine_name(engine), single * 1e3, single * 1e9 / num_ent,
+				max_threads, multi * 1e3, same ? "" : "  MISMATCH");
+		printf("           relayout %.2f ms, extent %.0f x %.0f\n", relayout * 1e3,
+				max.x - min.x, max.z - min.z);
+	}
+
+	delete tree;
+	return 0;
+}
+
+static double time_layout(Dir *tree, int repeat)
+{
+	double best = 1e9;
+	for(int i=0; i<repeat; i++) {
+		double t0 = get_time_sec();
+		tree->layout();
+		double sec = get_time_sec() - t0;
+		if(sec < best) best = sec;
+	}
+	return best;
+}
+
+static void get_positions(const Dir *dir, std::vector<Vector3> *pos)
+{
+	pos->push_back(dir->get_vis_pos());
+
+	int num_files = dir->get_num_files();
+	for(int i=0; i<num_files; i++) {
+		pos->push_back(dir->get_file(i)->get_vis_pos());
+	}
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		get_positions(dir->get_subdir(i), pos);
+	}
+}
+
+// the directories are enough, the files are on top of them
+static void get_extent(const Dir *dir, Vector3 *min, Vector3 *max)
+{
+	const Vector3 &pos = dir->get_vis_pos();
+	const Vector3 &size = dir->get_vis_size();
+
+	if(pos.x - size.x / 2.0 < min->x) min->x = pos.x - size.x / 2.0;
+	if(pos.z - size.z / 2.0 < min->z) min->z = pos.z - size.z / 2.0;
+	if(pos.x + size.x / 2.0 > max->x) max->x = pos.x + size.x / 2.0;
+	if(pos.z + size.z / 2.0 > max->z) max->z = pos.z + size.z / 2.0;
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		get_extent(dir->get_subdir(i), min, max);
+	}
+}
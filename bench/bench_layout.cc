@@ -0,0 +1,190 @@
+/* time of a full layout of a synthetic tree against the number of threads,
+ * doubling from one up to the number of cpus (or -t). Each run is checked to
+ * put every node exactly where a single thread does. Then the time to lay out
+ * again after a file is added at the bottom of the tree, that of a frame of
+ * the animation after a change which moves every node, and that of sizing all
+ * the files again by each mapping, checked against a full layout.
+ * usage: bench_layout [-d depth] [-f fanout] [-n files per dir] [-r repeat] [-t max threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+#include "fstree.h"
+#include "scan.h"
+#include "anim.h"
+#include "filegeom.h"
+#include "benchutil.h"
+
+static void get_positions(const Dir *dir, std::vector<Vector3> *pos);
+
+int main(int argc, char **argv)
+{
+	int depth = 5, fanout = 8, num_files = 20, repeat = 5;
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][2] == 0 && i < argc - 1) {
+			int val = atoi(argv[++i]);
+			switch(argv[i - 1][1]) {
+			case 'd': depth = val; break;
+			case 'f': fanout = val; break;
+			case 'n': num_files = val; break;
+			case 'r': repeat = val; break;
+			case 't': max_threads = val; break;
+			default:
+				fprintf(stderr, "invalid option: %s\n", argv[i - 1]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-d depth] [-f fanout] [-n files] [-r repeat] [-t threads]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(max_threads < 1) {
+		max_threads = 1;
+	}
+
+	// same as fsnav
+	set_layout_param(LP_FILE_SIZE, 0.5);
+	set_layout_param(LP_FILE_SPACING, 0.1);
+	set_layout_param(LP_FILE_HEIGHT, 0.1);
+	set_layout_param(LP_FILE_MAX_HEIGHT, 2.0);
+	set_layout_param(LP_DIR_SIZE, 0.5 + 0.2);
+	set_layout_param(LP_DIR_SPACING, 0.5);
+	set_layout_param(LP_DIR_HEIGHT, 0.1);
+	set_layout_param(LP_DIR_DIST, 5.0);
+
+	printf("building tree in memory: depth %d, fanout %d, %d files per dir\n", depth, fanout, num_files);
+	Dir *tree = gen_mem_tree(depth, fanout, num_files);
+	calc_tree_stats(tree);	// layout goes by the aggregates to decide on threads
+
+	set_scan_threads(1);
+	tree->layout();
+	std::vector<Vector3> ref, pos;
+	get_positions(tree, &ref);
+	printf("  %ld entries, best of %d\n", (long)ref.size(), repeat);
+
+	double base = 0;
+	for(int nthreads=1; ; nthreads*=2) {
+		if(nthreads > max_threads) {
+			nthreads = max_threads;
+		}
+		set_scan_threads(nthreads);
+
+		double best = 1e9;
+		for(int i=0; i<repeat; i++) {
+			double t0 = get_time_sec();
+			tree->layout();
+			double sec = get_time_sec() - t0;
+			if(sec < best) best = sec;
+		}
+		if(nthreads == 1) {
+			base = best;
+		}
+
+		pos.clear();
+		get_positions(tree, &pos);
+		bool same = pos.size() == ref.size();
+		for(size_t i=0; same && i<pos.size(); i++) {
+			same = pos[i].x == ref[i].x && pos[i].y == ref[i].y && pos[i].z == ref[i].z;
+		}
+
+		printf("  %2d threads %8.2f ms  (%.1f ns/entry, %.2fx)%s\n", nthreads, best * 1e3,
+				best * 1e9 / ref.size(), base / best, same ? "" : "  MISMATCH");
+
+		if(nthreads >= max_threads) {
+			break;
+		}
+	}
+
+	// the last directory, so that only its own subtree moves
+	Dir *leaf = tree;
+	while(leaf->get_num_subdirs()) {
+		leaf = leaf->get_subdir(leaf->get_num_subdirs() - 1);
+	}
+
+	double best = 1e9;
+	for(int i=0; i<repeat; i++) {
+		File *file = new_file(leaf->get_arena());
+		file->set_name("new");
+
+		double t0 = get_time_sec();
+		leaf->add_file(file);
+		leaf->relayout();
+		double sec = get_time_sec() - t0;
+		if(sec < best) best = sec;
+	}
+	printf("  relayout   %8.2f us  (one file added, %d levels down)\n", best * 1e6, depth);
+
+	// wider spacing moves everything, but the files of the root
+	begin_layout_change(tree, true);
+	set_layout_param(LP_DIR_SPACING, 1.0);
+	tree->layout();
+	end_layout_change(0);
+	int count = get_anim_count();
+
+	best = 1e9;
+	for(int i=0; i<repeat; i++) {
+		double t0 = get_time_sec();
+		update_anim(get_anim_time() * 500.0 / repeat * i / 2);
+		double sec = get_time_sec() - t0;
+		if(sec < best) best = sec;
+	}
+	printf("  anim frame %8.2f us  (%d nodes moving, %.1f ns/node)\n", best * 1e6, count,
+			best * 1e9 / count);
+
+	// out of the middle of the animation
+	tree->layout();
+	long num_ent = ref.size();
+
+	for(int func=0; func<NUM_GEOM_FUNCS; func++) {
+		set_file_geom(GEOM_HEIGHT, func, GEOM_BY_SIZE);
+		set_file_geom(GEOM_FOOTPRINT, func, GEOM_BY_AGE);
+
+		best = 1e9;
+		for(int i=0; i<repeat; i++) {
+			double t0 = get_time_sec();
+			update_file_geom(tree);
+			double sec = get_time_sec() - t0;
+			if(sec < best) best = sec;
+		}
+
+		ref.clear();
+		get_positions(tree, &ref);
+		tree->layout();
+		pos.clear();
+		get_positions(tree, &pos);
+		float maxd = 0;
+		for(size_t i=0; i<pos.size(); i++) {
+			float d = fabs(pos[i].x - ref[i].x) + fabs(pos[i].y - ref[i].y) + fabs(pos[i].z - ref[i].z);
+			if(d > maxd) maxd = d;
+		}
+		// the files are moved from their old height, which rounds differently
+		bool same = maxd < 1e-5;
+
+		char name[32];
+		sprintf(name, "geom %s", get_file_geom_name(func));
+		printf("  %-16s %8.2f ms  (%.1f ns/entry)%s\n", name, best * 1e3,
+				best * 1e9 / num_ent, same ? "" : "  MISMATCH");
+	}
+
+	delete tree;
+	return 0;
+}
+
+static void get_positions(const Dir *dir, std::vector<Vector3> *pos)
+{
+	pos->push_back(dir->get_vis_pos());
+
+	int num_files = dir->get_num_files();
+	for(int i=0; i<num_files; i++) {
+		pos->push_back(dir->get_file(i)->get_vis_pos());
+	}
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		get_positions(dir->get_subdir(i), pos);
+	}
+}
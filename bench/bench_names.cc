@@ -0,0 +1,96 @@
+/* memory used for the names of a tree, interned against one copy per node
+ * usage: bench_names [-d depth] [-f fanout] [-n files per dir] [-t threads] [dir]
+ * without a directory, a synthetic tree is built in memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fstree.h"
+#include "arena.h"
+#include "scan.h"
+#include "benchutil.h"
+
+struct NameStats {
+	long num_nodes;
+	size_t copies;	// one copy per node, from the arena
+	size_t heap;	// one new char[] per node, with glibc malloc overhead
+};
+
+static void count_names(const FSNode *node, NameStats *st);
+
+int main(int argc, char **argv)
+{
+	int depth = 5, fanout = 8, num_files = 20;
+	const char *dirname = 0;
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][2] == 0 && i < argc - 1) {
+			int val = atoi(argv[++i]);
+			switch(argv[i - 1][1]) {
+			case 'd': depth = val; break;
+			case 'f': fanout = val; break;
+			case 'n': num_files = val; break;
+			case 't': set_scan_threads(val); break;
+			default:
+				fprintf(stderr, "invalid option: %s\n", argv[i - 1]);
+				return 1;
+			}
+		} else if(argv[i][0] != '-' && !dirname) {
+			dirname = argv[i];
+		} else {
+			fprintf(stderr, "usage: %s [-d depth] [-f fanout] [-n files] [-t threads] [dir]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	Dir *tree;
+	if(dirname) {
+		printf("scanning %s\n", dirname);
+		tree = new Dir;
+		if(!build_tree(tree, dirname)) {
+			delete tree;
+			return 1;
+		}
+	} else {
+		printf("building tree in memory: depth %d, fanout %d, %d files per dir\n", depth, fanout, num_files);
+		tree = gen_mem_tree(depth, fanout, num_files);
+	}
+
+	NameStats st;
+	memset(&st, 0, sizeof st);
+	count_names(tree, &st);
+
+	NodeArena *arena = tree->get_arena();
+	double n = st.num_nodes;
+
+	printf("  %ld entries, %ld distinct names\n", st.num_nodes, (long)arena->get_num_names());
+	printf("  name bytes per entry:\n");
+	printf("    new char[] per node   %6.2f\n", st.heap / n);
+	printf("    arena copy per node   %6.2f\n", st.copies / n);
+	printf("    interned              %6.2f  (%.1fx smaller than new char[])\n",
+			arena->get_name_bytes() / n, (double)st.heap / arena->get_name_bytes());
+
+	delete tree;
+	return 0;
+}
+
+static void count_names(const FSNode *node, NameStats *st)
+{
+	size_t len = strlen(node->get_name()) + 1;
+
+	st->num_nodes++;
+	st->copies += (len + 7) & ~(size_t)7;
+	// glibc: 8 bytes of header, 16 byte granularity, 32 bytes minimum
+	size_t chunk = (len + 8 + 15) & ~(size_t)15;
+	st->heap += chunk < 32 ? 32 : chunk;
+
+	if(node->is_dir()) {
+		const Dir *dir = (const Dir*)node;
+		for(int i=0; i<dir->get_num_subdirs(); i++) {
+			count_names(dir->get_subdir(i), st);
+		}
+		for(int i=0; i<dir->get_num_files(); i++) {
+			count_names(dir->get_file(i), st);
+		}
+	}
+}
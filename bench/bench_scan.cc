@@ -0,0 +1,100 @@
+/* compares the scanner backends on a synthetic tree
+ * usage: bench_scan [-d depth] [-f fanout] [-n files per dir] [-t threads] [-r repeat]
+ *        [-e exclude glob]...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fstree.h"
+#include "scan.h"
+#include "benchutil.h"
+
+static long count_nodes(const Dir *dir);
+static double bench(int backend, const char *path, int repeat, long *num_nodes);
+
+int main(int argc, char **argv)
+{
+	int depth = 4, fanout = 8, num_files = 20, repeat = 5;
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][2] == 0 && i < argc - 1) {
+			int val = atoi(argv[++i]);
+			switch(argv[i - 1][1]) {
+			case 'd': depth = val; break;
+			case 'f': fanout = val; break;
+			case 'n': num_files = val; break;
+			case 't': set_scan_threads(val); break;
+			case 'r': repeat = val; break;
+			case 'e': add_scan_exclude(argv[i]); break;
+			default:
+				fprintf(stderr, "invalid option: %s\n", argv[i - 1]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-d depth] [-f fanout] [-n files] [-t threads] [-r repeat] [-e glob]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	char path[512];
+	sprintf(path, "%s/fsnav-bench-%d", bench_scratch_dir(), (int)getpid());
+
+	printf("generating tree: depth %d, fanout %d, %d files per dir in %s\n", depth, fanout, num_files, path);
+	double t0 = get_time_sec();
+	long num_ent = gen_tree(path, depth, fanout, num_files);
+	if(num_ent < 0) {
+		remove_tree(path);
+		return 1;
+	}
+	printf("  %ld entries in %.2f sec\n", num_ent, get_time_sec() - t0);
+	printf("scanning with %d threads, best of %d\n", get_scan_threads(), repeat);
+
+	static const char *names[] = {"posix", "io_uring"};
+	static const int backends[] = {SCAN_BACKEND_POSIX, SCAN_BACKEND_URING};
+
+	for(int i=0; i<2; i++) {
+		long num_nodes;
+		double sec = bench(backends[i], path, repeat, &num_nodes);
+		if(sec < 0) {
+			continue;
+		}
+		printf("  %-10s %8.2f ms  %10.0f entries/sec  (%ld nodes)\n", names[i], sec * 1000.0,
+				num_nodes / sec, num_nodes);
+	}
+
+	remove_tree(path);
+	return 0;
+}
+
+static long count_nodes(const Dir *dir)
+{
+	long count = dir->get_num_files() + dir->get_num_subdirs();
+	for(int i=0; i<dir->get_num_subdirs(); i++) {
+		count += count_nodes(dir->get_subdir(i));
+	}
+	return count;
+}
+
+static double bench(int backend, const char *path, int repeat, long *num_nodes)
+{
+	double best = -1.0;
+
+	set_scan_backend(backend);
+
+	for(int i=0; i<repeat; i++) {
+		Dir *tree = new Dir;
+
+		double t0 = get_time_sec();
+		if(!build_tree(tree, path)) {
+			return -1.0;
+		}
+		double sec = get_time_sec() - t0;
+
+		if(best < 0.0 || sec < best) {
+			best = sec;
+		}
+		*num_nodes = count_nodes(tree);
+	}
+	return best;
+}
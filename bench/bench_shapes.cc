@@ -0,0 +1,208 @@
+/* scanner throughput on synthetic trees of different shapes, generated in a
+ * tmpfs if there is one (see bench_scratch_dir). For each backend: the wall
+ * time of build_tree, entries per second, system calls per entry, and the
+ * peak memory of a process which did nothing but scan the tree.
+ * usage: bench_shapes [-s shape]... [-n entries] [-t threads] [-r repeat]
+ * shapes: deep, wide, flat, powerlaw, and huge (not run by default)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fstree.h"
+#include "scan.h"
+#include "benchutil.h"
+
+struct Shape {
+	const char *name, *desc;
+	int depth, fanout, num_files;	// regular trees, if num_entries is 0
+	long num_entries;				// power-law trees
+	bool run;
+};
+
+struct ScanJob {
+	const char *path;
+	int backend, repeat;
+	// filled in by the child process
+	double best;
+	long num_nodes;
+};
+
+static Shape shapes[] = {
+	{"deep", "deep and narrow", 14, 2, 3, 0, true},
+	{"wide", "wide and shallow", 1, 32, 4000, 0, true},
+	{"flat", "one large directory", 0, 0, 100000, 0, true},
+	{"powerlaw", "power-law fanout", 0, 0, 0, 150000, true},
+	{"huge", "power-law fanout", 0, 0, 0, 2000000, false},
+	{0, 0, 0, 0, 0, 0, false}
+};
+
+static bool bench_shape(const Shape *shape, ScanJob *job);
+static void timed_scan(void *arg);
+static void single_scan(void *arg);
+static long count_nodes(const Dir *dir);
+
+int main(int argc, char **argv)
+{
+	int repeat = 3;
+	long num_entries = 0;
+	bool picked = false;
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][2] == 0 && i < argc - 1) {
+			const char *arg = argv[++i];
+			switch(argv[i - 1][1]) {
+			case 's':
+				if(!picked) {
+					for(int j=0; shapes[j].name; j++) {
+						shapes[j].run = false;
+					}
+					picked = true;
+				}
+				for(int j=0; shapes[j].name; j++) {
+					if(strcmp(shapes[j].name, arg) == 0) {
+						shapes[j].run = true;
+						arg = 0;
+						break;
+					}
+				}
+				if(arg) {
+					fprintf(stderr, "unknown shape: %s\n", arg);
+					return 1;
+				}
+				break;
+
+			case 'n': num_entries = atol(arg); break;
+			case 't': set_scan_threads(atoi(arg)); break;
+			case 'r': repeat = atoi(arg); break;
+			default:
+				fprintf(stderr, "invalid option: %s\n", argv[i - 1]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-s deep|wide|flat|powerlaw|huge]... [-n entries] [-t threads] [-r repeat]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(num_entries > 0) {
+		for(int i=0; shapes[i].name; i++) {
+			if(shapes[i].num_entries) {
+				shapes[i].num_entries = num_entries;
+			}
+		}
+	}
+
+	// the result of the child processes goes here
+	ScanJob *job = (ScanJob*)alloc_shared(sizeof *job);
+	if(!job) {
+		perror("failed to allocate shared memory");
+		return 1;
+	}
+	job->repeat = repeat;
+
+	printf("scanning with %d threads, best of %d\n", get_scan_threads(), repeat);
+
+	for(int i=0; shapes[i].name; i++) {
+		if(shapes[i].run && !bench_shape(shapes + i, job)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static bool bench_shape(const Shape *shape, ScanJob *job)
+{
+	char path[512];
+	sprintf(path, "%s/fsnav-bench-%d", bench_scratch_dir(), (int)getpid());
+	job->path = path;
+
+	printf("%s: %s, ", shape->name, shape->desc);
+	if(shape->num_entries) {
+		printf("%ld entries\n", shape->num_entries);
+	} else {
+		printf("depth %d, fanout %d, %d files per dir\n", shape->depth, shape->fanout, shape->num_files);
+	}
+	fflush(stdout);
+
+	double t0 = get_time_sec();
+	long num_ent;
+	if(shape->num_entries) {
+		num_ent = gen_tree_powerlaw(path, shape->num_entries, 1);
+	} else {
+		num_ent = gen_tree(path, shape->depth, shape->fanout, shape->num_files);
+	}
+	if(num_ent < 0) {
+		remove_tree(path);
+		return false;
+	}
+	printf("  generated %ld entries in %.2f sec\n", num_ent, get_time_sec() - t0);
+
+	static const char *names[] = {"posix", "io_uring"};
+	static const int backends[] = {SCAN_BACKEND_POSIX, SCAN_BACKEND_URING};
+
+	for(int i=0; i<2; i++) {
+		job->backend = backends[i];
+		job->best = -1.0;
+
+		long rss = run_forked(timed_scan, job);
+		if(rss < 0 || job->best < 0) {
+			continue;	// no io_uring support
+		}
+		long nsys = count_syscalls(single_scan, job);
+
+		printf("  %-10s %8.2f ms  %10.0f entries/sec", names[i], job->best * 1e3,
+				job->num_nodes / job->best);
+		if(nsys >= 0) {
+			printf("  %6.2f syscalls/entry", (double)nsys / job->num_nodes);
+		} else {
+			printf("  ? syscalls/entry");
+		}
+		printf("  %7.1f mb peak (%ld bytes/entry)\n", rss / 1024.0, rss * 1024 / job->num_nodes);
+	}
+
+	remove_tree(path);
+	return true;
+}
+
+// runs in a child process, so that each gets its own peak memory usage
+static void timed_scan(void *arg)
+{
+	ScanJob *job = (ScanJob*)arg;
+
+	set_scan_backend(job->backend);
+
+	for(int i=0; i<job->repeat; i++) {
+		Dir *tree = new Dir;
+
+		double t0 = get_time_sec();
+		if(!build_tree(tree, job->path)) {
+			return;
+		}
+		double sec = get_time_sec() - t0;
+
+		if(job->best < 0.0 || sec < job->best) {
+			job->best = sec;
+		}
+		job->num_nodes = count_nodes(tree);
+		delete tree;
+	}
+}
+
+// runs traced, the tree is left for the process exit to free
+static void single_scan(void *arg)
+{
+	ScanJob *job = (ScanJob*)arg;
+
+	set_scan_backend(job->backend);
+	build_tree(new Dir, job->path);
+}
+
+static long count_nodes(const Dir *dir)
+{
+	long count = dir->get_num_files() + dir->get_num_subdirs();
+	for(int i=0; i<dir->get_num_subdirs(); i++) {
+		count += count_nodes(dir->get_subdir(i));
+	}
+	return count;
+}
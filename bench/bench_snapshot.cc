@@ -0,0 +1,178 @@
+/* opening and walking a tree snapshot in place, against creating the whole
+ * tree from it, on a synthetic tree built in memory.
+ * usage: bench_snapshot [-d depth] [-f fanout] [-n files per dir] [-r repeat]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "fstree.h"
+#include "snapshot.h"
+#include "benchutil.h"
+
+static uint64_t walk(const Snapshot *snap, long *num_nodes);
+static long count_nodes(const Dir *dir);
+static void release_memory();
+
+int main(int argc, char **argv)
+{
+	int depth = 5, fanout = 8, num_files = 20, repeat = 5;
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][2] == 0 && i < argc - 1) {
+			int val = atoi(argv[++i]);
+			switch(argv[i - 1][1]) {
+			case 'd': depth = val; break;
+			case 'f': fanout = val; break;
+			case 'n': num_files = val; break;
+			case 'r': repeat = val; break;
+			default:
+				fprintf(stderr, "invalid option: %s\n", argv[i - 1]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-d depth] [-f fanout] [-n files] [-r repeat]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	char fname[512];
+	sprintf(fname, "%s/fsnav-bench-%d.snap", bench_scratch_dir(), (int)getpid());
+
+	printf("building tree in memory: depth %d, fanout %d, %d files per dir\n", depth, fanout, num_files);
+	Dir *tree = gen_mem_tree(depth, fanout, num_files);
+	long num_ent = count_nodes(tree);
+
+	double t0 = get_time_sec();
+	if(!write_snapshot(tree, fname)) {
+		delete tree;
+		return 1;
+	}
+	double write_sec = get_time_sec() - t0;
+	delete tree;
+	release_memory();
+
+	struct stat st;
+	stat(fname, &st);
+	printf("  %ld entries, snapshot %.1f mb (%.1f bytes/entry), written in %.2f ms\n", num_ent,
+			st.st_size / 1048576.0, (double)st.st_size / num_ent, write_sec * 1000.0);
+	printf("best of %d, page cache warm\n", repeat);
+
+	double best_open = -1.0, best_walk = -1.0, best_partial = -1.0, best_full = -1.0;
+	long walk_rss = 0, full_rss = 0, partial_nodes = 0;
+	uint64_t total_size = 0;
+
+	for(int i=0; i<repeat; i++) {
+		Snapshot snap;
+		long rss0 = get_anon_rss();
+
+		t0 = get_time_sec();
+		if(!snap.open(fname)) {
+			goto end;
+		}
+		double sec = get_time_sec() - t0;
+		if(best_open < 0.0 || sec < best_open) {
+			best_open = sec;
+		}
+
+		long num_walked;
+		t0 = get_time_sec();
+		total_size = walk(&snap, &num_walked);
+		sec = get_time_sec() - t0;
+		if(best_walk < 0.0 || sec < best_walk) {
+			best_walk = sec;
+		}
+		if(num_walked != num_ent) {
+			fprintf(stderr, "walked %ld of %ld entries\n", num_walked, num_ent);
+			goto end;
+		}
+		walk_rss = get_anon_rss() - rss0;
+
+		// what the viewer does: the first few levels only
+		t0 = get_time_sec();
+		tree = snap.create_tree(3);
+		sec = get_time_sec() - t0;
+		if(best_partial < 0.0 || sec < best_partial) {
+			best_partial = sec;
+		}
+		partial_nodes = count_nodes(tree);
+		delete tree;
+		release_memory();
+
+		// and what loading the scan cache does: all of it
+		rss0 = get_anon_rss();
+		t0 = get_time_sec();
+		tree = snap.create_tree(0);
+		sec = get_time_sec() - t0;
+		if(best_full < 0.0 || sec < best_full) {
+			best_full = sec;
+		}
+		full_rss = get_anon_rss() - rss0;
+		delete tree;
+		release_memory();
+	}
+
+	printf("  open                    %8.3f ms\n", best_open * 1000.0);
+	printf("  walk in place           %8.2f ms  (%.1f ns/entry, %ld kb private, %llu bytes total)\n",
+			best_walk * 1000.0, best_walk * 1e9 / num_ent, walk_rss, (unsigned long long)total_size);
+	printf("  create 3 levels         %8.2f ms  (%ld entries)\n", best_partial * 1000.0, partial_nodes);
+	printf("  create whole tree       %8.2f ms  (%ld kb private)\n", best_full * 1000.0, full_rss);
+
+end:
+	remove(fname);
+	return 0;
+}
+
+// sums the file sizes of the whole tree, going down through the child ranges
+static uint64_t walk(const Snapshot *snap, long *num_nodes)
+{
+	std::vector<uint32_t> stack;
+	uint64_t total = 0;
+	long count = 0;
+
+	stack.push_back(0);
+	while(!stack.empty()) {
+		uint32_t idx = stack.back();
+		stack.pop_back();
+		count++;
+
+		uint32_t first = snap->get_first_child(idx);
+		uint32_t num_subdirs = snap->get_num_subdirs(idx);
+		uint32_t num_files = snap->get_num_files(idx);
+
+		for(uint32_t i=0; i<num_subdirs; i++) {
+			stack.push_back(first + i);
+		}
+		for(uint32_t i=0; i<num_files; i++) {
+			total += snap->get_size(first + num_subdirs + i);
+		}
+		count += num_files;
+	}
+
+	*num_nodes = count;
+	return total;
+}
+
+static long count_nodes(const Dir *dir)
+{
+	long count = 1 + dir->get_num_files();
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		count += count_nodes(dir->get_subdir(i));
+	}
+	return count;
+}
+
+// hands freed memory back to the system, so that the rss of the next step is its own
+static void release_memory()
+{
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+}
@@ -0,0 +1,133 @@
+/* per-node cost of the passes the render loop makes over the whole tree:
+ * color mapping and text placement, and picking with a ray which has to be
+ * tested against every node. Also the aggregates of the whole tree computed
+ * from scratch, and updated after a single file changed. The tree is
+ * synthetic, built in memory.
+ * usage: bench_traverse [-d depth] [-f fanout] [-n files per dir] [-r repeat] [-t threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "fstree.h"
+#include "colorman.h"
+#include "scan.h"
+#include "benchutil.h"
+
+static float color_pass(const Dir *dir);
+static long count_nodes(const Dir *dir);
+
+int main(int argc, char **argv)
+{
+	int depth = 5, fanout = 8, num_files = 20, repeat = 5;
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][2] == 0 && i < argc - 1) {
+			int val = atoi(argv[++i]);
+			switch(argv[i - 1][1]) {
+			case 'd': depth = val; break;
+			case 'f': fanout = val; break;
+			case 'n': num_files = val; break;
+			case 'r': repeat = val; break;
+			case 't': set_scan_threads(val); break;
+			default:
+				fprintf(stderr, "invalid option: %s\n", argv[i - 1]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "usage: %s [-d depth] [-f fanout] [-n files] [-r repeat] [-t threads]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// same as fsnav
+	set_layout_param(LP_FILE_SIZE, 0.5);
+	set_layout_param(LP_FILE_SPACING, 0.1);
+	set_layout_param(LP_FILE_HEIGHT, 0.1);
+	set_layout_param(LP_FILE_MAX_HEIGHT, 2.0);
+	set_layout_param(LP_DIR_SIZE, 0.5 + 0.2);
+	set_layout_param(LP_DIR_SPACING, 0.5);
+	set_layout_param(LP_DIR_HEIGHT, 0.1);
+	set_layout_param(LP_DIR_DIST, 5.0);
+
+	printf("building tree in memory: depth %d, fanout %d, %d files per dir\n", depth, fanout, num_files);
+	Dir *tree = gen_mem_tree(depth, fanout, num_files);
+	tree->layout();
+	long num_ent = count_nodes(tree);
+	printf("  %ld entries, %d threads, best of %d\n", num_ent, get_scan_threads(), repeat);
+
+	// straight down onto the root, and a ray which passes over everything
+	Ray hit_ray(tree->get_vis_pos() + Vector3(0, 100, 0), Vector3(0, -1, 0));
+	Ray miss_ray(Vector3(0, 100, 0), Vector3(1, 0, 0));
+
+	// the deepest directory, for the incremental update
+	Dir *leaf = tree;
+	while(leaf->get_num_subdirs()) {
+		leaf = leaf->get_subdir(leaf->get_num_subdirs() - 1);
+	}
+	File *file = leaf->get_file(0);
+	std::vector<Dir*> changed(1, leaf);
+
+	double best[5] = {1e9, 1e9, 1e9, 1e9, 1e9};
+	float sum = 0;
+	for(int i=0; i<repeat; i++) {
+		double t0 = get_time_sec();
+		sum += color_pass(tree);
+		double t1 = get_time_sec();
+		tree->pick(hit_ray);
+		double t2 = get_time_sec();
+		tree->pick(miss_ray);
+		double t3 = get_time_sec();
+		calc_tree_stats(tree);
+		double t4 = get_time_sec();
+		file->set_size(file->get_size() + 1);
+		update_stats(changed);
+		double t5 = get_time_sec();
+
+		if(t1 - t0 < best[0]) best[0] = t1 - t0;
+		if(t2 - t1 < best[1]) best[1] = t2 - t1;
+		if(t3 - t2 < best[2]) best[2] = t3 - t2;
+		if(t4 - t3 < best[3]) best[3] = t4 - t3;
+		if(t5 - t4 < best[4]) best[4] = t5 - t4;
+	}
+
+	static const char *names[] = {"color/text", "pick (hit)", "pick (miss)", "tree stats"};
+	for(int i=0; i<4; i++) {
+		printf("  %-12s %8.2f ms  (%.1f ns/entry)\n", names[i], best[i] * 1e3,
+				best[i] * 1e9 / num_ent);
+	}
+	printf("  %-12s %8.2f us  (one file changed, %d levels up)\n", "stats update",
+			best[4] * 1e6, depth);
+	if(sum < 0) {
+		printf("%f\n", sum);	// keeps the color pass from being optimized out
+	}
+
+	delete tree;
+	return 0;
+}
+
+static float color_pass(const Dir *dir)
+{
+	Vector3 col = get_color(dir);
+	float sum = col.x + dir->get_text_size();
+
+	int num_files = dir->get_num_files();
+	for(int i=0; i<num_files; i++) {
+		const File *file = dir->get_file(i);
+		col = get_color(file);
+		sum += col.x + file->get_text_size() + file->get_text_pos().y;
+	}
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		sum += color_pass(dir->get_subdir(i));
+	}
+	return sum;
+}
+
+static long count_nodes(const Dir *dir)
+{
+	long count = 1 + dir->get_num_files();
+	for(int i=0; i<dir->get_num_subdirs(); i++) {
+		count += count_nodes(dir->get_subdir(i));
+	}
+	return count;
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <math.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <deque>
+#include <set>
+#include <string>
+#include "benchutil.h"
+#include "fstree.h"
+
+#define POWERLAW_MAX_DEPTH	32
+
+static long gen_dir(int dirfd, int depth, int fanout, int num_files);
+static long pareto(unsigned int *rng, double alpha, long max);
+static long trace_child(void (*func)(void*), void *arg);
+static bool remove_dir(int dirfd, const char *name);
+static void gen_mem_dir(Dir *dir, int depth, int fanout, int num_files);
+
+double get_time_sec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+const char *bench_scratch_dir()
+{
+	const char *dir;
+	struct stat st;
+
+	if((dir = getenv("BENCH_DIR"))) {
+		return dir;
+	}
+	if(stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) && access("/dev/shm", W_OK) == 0) {
+		return "/dev/shm";
+	}
+	if((dir = getenv("TMPDIR"))) {
+		return dir;
+	}
+	return "/tmp";
+}
+
+long gen_tree(const char *path, int depth, int fanout, int num_files)
+{
+	if(mkdir(path, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "failed to create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	int fd = open(path, O_RDONLY | O_DIRECTORY);
+	if(fd == -1) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	long count = gen_dir(fd, depth, fanout, num_files);
+	close(fd);
+	return count;
+}
+
+static long gen_dir(int dirfd, int depth, int fanout, int num_files)
+{
+	char name[32];
+	long count = 0;
+
+	for(int i=0; i<num_files; i++) {
+		sprintf(name, "file%d", i);
+		int fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd == -1) {
+			fprintf(stderr, "failed to create %s: %s\n", name, strerror(errno));
+			return -1;
+		}
+		close(fd);
+		count++;
+	}
+
+	if(depth <= 0) {
+		return count;
+	}
+
+	for(int i=0; i<fanout; i++) {
+		sprintf(name, "dir%d", i);
+		if(mkdirat(dirfd, name, 0755) == -1 && errno != EEXIST) {
+			fprintf(stderr, "failed to create %s: %s\n", name, strerror(errno));
+			return -1;
+		}
+		int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY);
+		if(fd == -1) {
+			return -1;
+		}
+
+		long sub = gen_dir(fd, depth - 1, fanout, num_files);
+		close(fd);
+		if(sub == -1) {
+			return -1;
+		}
+		count += sub + 1;
+	}
+	return count;
+}
+
+long gen_tree_powerlaw(const char *path, long num_entries, unsigned int seed)
+{
+	if(mkdir(path, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "failed to create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	int rootfd = open(path, O_RDONLY | O_DIRECTORY);
+	if(rootfd == -1) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	/* breadth first, so that running out of entries leaves the last level
+	 * unfinished, instead of the last few subtrees at the top
+	 */
+	std::deque<std::pair<std::string, int> > queue;
+	queue.push_back(std::make_pair(std::string("."), 0));
+
+	unsigned int rng = seed ? seed : 1;
+	long count = 0;
+	char name[32];
+
+	while(!queue.empty() && count < num_entries) {
+		std::string dir = queue.front().first;
+		int depth = queue.front().second;
+		queue.pop_front();
+
+		long num_files = pareto(&rng, 1.2, 50000) - 1;
+		long num_subdirs = depth < POWERLAW_MAX_DEPTH ? pareto(&rng, 1.5, 1000) - 1 : 0;
+		if(queue.empty() && !num_subdirs) {
+			num_subdirs = 1;	// most directories have none, don't let it die out
+		}
+
+		for(long i=0; i<num_files && count < num_entries; i++) {
+			sprintf(name, "/file%ld", i);
+			int fd = openat(rootfd, (dir + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if(fd == -1) {
+				fprintf(stderr, "failed to create %s%s: %s\n", dir.c_str(), name, strerror(errno));
+				close(rootfd);
+				return -1;
+			}
+			close(fd);
+			count++;
+		}
+
+		for(long i=0; i<num_subdirs && count < num_entries; i++) {
+			sprintf(name, "/dir%ld", i);
+			std::string sub = dir + name;
+			if(mkdirat(rootfd, sub.c_str(), 0755) == -1 && errno != EEXIST) {
+				fprintf(stderr, "failed to create %s: %s\n", sub.c_str(), strerror(errno));
+				close(rootfd);
+				return -1;
+			}
+			queue.push_back(std::make_pair(sub, depth + 1));
+			count++;
+		}
+	}
+
+	close(rootfd);
+	return count;
+}
+
+// 1, 2, 3 ... with P(x >= n) = n^-alpha, up to max
+static long pareto(unsigned int *rng, double alpha, long max)
+{
+	// xorshift32
+	*rng ^= *rng << 13;
+	*rng ^= *rng >> 17;
+	*rng ^= *rng << 5;
+
+	double u = ((*rng >> 8) + 1) / 16777216.0;
+	double x = pow(u, -1.0 / alpha);
+	return x < max ? (long)x : max;
+}
+
+bool remove_tree(const char *path)
+{
+	return remove_dir(AT_FDCWD, path);
+}
+
+static bool remove_dir(int dirfd, const char *name)
+{
+	int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if(fd == -1) {
+		return false;
+	}
+
+	DIR *dir = fdopendir(fd);
+	if(!dir) {
+		close(fd);
+		return false;
+	}
+
+	struct dirent *dent;
+	while((dent = readdir(dir))) {
+		if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
+			continue;
+		}
+		if(unlinkat(fd, dent->d_name, 0) == -1) {
+			if(errno == EISDIR || errno == EPERM) {
+				remove_dir(fd, dent->d_name);
+			}
+		}
+	}
+	closedir(dir);
+
+	return unlinkat(dirfd, name, AT_REMOVEDIR) == 0;
+}
+
+Dir *gen_mem_tree(int depth, int fanout, int num_files)
+{
+	Dir *root = new Dir;
+	root->set_name("root");
+	gen_mem_dir(root, depth, fanout, num_files);
+	return root;
+}
+
+static void gen_mem_dir(Dir *dir, int depth, int fanout, int num_files)
+{
+	char name[32];
+
+	for(int i=0; i<num_files; i++) {
+		struct stat st;
+		memset(&st, 0, sizeof st);
+		st.st_mode = S_IFREG | 0644;
+		st.st_size = (i + 1) * 512;
+		st.st_atime = st.st_mtime = st.st_ctime = 1000000000 + i;
+
+		sprintf(name, "file%d", i);
+		File *file = new_file(dir->get_arena());
+		file->set_name(name);
+		file->set_stat(&st);
+		file->set_links(1);
+		dir->add_file(file);
+	}
+
+	if(depth <= 0) {
+		return;
+	}
+
+	for(int i=0; i<fanout; i++) {
+		sprintf(name, "dir%d", i);
+		Dir *sub = new_dir(dir->get_arena());
+		sub->set_name(name);
+		dir->add_subdir(sub);
+		gen_mem_dir(sub, depth - 1, fanout, num_files);
+	}
+}
+
+long get_anon_rss()
+{
+	char buf[256];
+	long kb = -1;
+
+	FILE *fp = fopen("/proc/self/status", "r");
+	if(!fp) {
+		return -1;
+	}
+	while(fgets(buf, sizeof buf, fp)) {
+		if(sscanf(buf, "RssAnon: %ld", &kb) == 1) {
+			break;
+		}
+	}
+	fclose(fp);
+	return kb;
+}
+
+long run_forked(void (*func)(void*), void *arg)
+{
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if(pid == -1) {
+		return -1;
+	}
+	if(!pid) {
+		func(arg);
+		_exit(0);
+	}
+
+	int status;
+	struct rusage ru;
+	if(wait4(pid, &status, 0, &ru) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		return -1;
+	}
+	return ru.ru_maxrss;
+}
+
+void *alloc_shared(size_t size)
+{
+	void *ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	return ptr == MAP_FAILED ? 0 : ptr;
+}
+
+long count_syscalls(void (*func)(void*), void *arg)
+{
+	long base = trace_child(0, 0);
+	long count = trace_child(func, arg);
+
+	if(base < 0 || count < 0) {
+		return -1;
+	}
+	return count - base;
+}
+
+/* the tracer stops at every entry to and exit from a system call, in every
+ * thread of the child. Which of the two it is, is kept track of per thread.
+ */
+static long trace_child(void (*func)(void*), void *arg)
+{
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if(pid == -1) {
+		return -1;
+	}
+	if(!pid) {
+		if(ptrace(PTRACE_TRACEME, 0, 0, 0) == -1) {
+			_exit(1);
+		}
+		raise(SIGSTOP);
+		if(func) {
+			func(arg);
+		}
+		_exit(0);
+	}
+
+	int status;
+	if(waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) {
+		return -1;
+	}
+	ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+	ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+	std::set<pid_t> in_syscall;
+	long count = 0;
+	bool failed = false;
+	pid_t tid;
+
+	while((tid = waitpid(-1, &status, __WALL)) != -1) {
+		if(!WIFSTOPPED(status)) {
+			in_syscall.erase(tid);
+			if(tid == pid && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+				failed = true;
+			}
+			continue;
+		}
+
+		int sig = WSTOPSIG(status);
+		if(sig == (SIGTRAP | 0x80)) {
+			if(!in_syscall.erase(tid)) {
+				in_syscall.insert(tid);
+				count++;
+			}
+			sig = 0;
+		} else if(sig == SIGTRAP || sig == SIGSTOP) {
+			sig = 0;	// thread creation events, and new threads starting
+		}
+		ptrace(PTRACE_SYSCALL, tid, 0, sig);
+	}
+
+	return failed ? -1 : count;
+}
@@ -0,0 +1,54 @@
+#ifndef BENCHUTIL_H_
+#define BENCHUTIL_H_
+
+#include <stddef.h>
+
+// wall clock time in seconds
+double get_time_sec();
+
+/* picks a scratch directory for synthetic trees: $BENCH_DIR if set,
+ * otherwise /dev/shm if it exists (tmpfs), otherwise $TMPDIR or /tmp.
+ */
+const char *bench_scratch_dir();
+
+/* generates a synthetic tree under path: every directory down to the given
+ * depth has fanout subdirectories and num_files empty files. Returns the
+ * number of entries created, or -1 on failure.
+ */
+long gen_tree(const char *path, int depth, int fanout, int num_files);
+
+/* generates a less regular tree of about num_entries entries, closer to a real
+ * filesystem: the number of files and subdirectories of each directory follow
+ * power laws, so most directories are small and a few are huge. The same seed
+ * gives the same tree. Returns the number of entries created, or -1.
+ */
+long gen_tree_powerlaw(const char *path, long num_entries, unsigned int seed);
+
+// removes a directory tree created by gen_tree
+bool remove_tree(const char *path);
+
+class Dir;
+
+/* builds the same shape of tree in memory, without touching the filesystem.
+ * Files get made up attributes, so that they have something to save.
+ */
+Dir *gen_mem_tree(int depth, int fanout, int num_files);
+
+// anonymous resident memory of the process in kb, or -1 if unknown
+long get_anon_rss();
+
+/* calls func(arg) in a child process, and returns the peak resident memory of
+ * the child in kb, or -1 if it failed. The child can pass results back through
+ * shared memory allocated with alloc_shared.
+ */
+long run_forked(void (*func)(void*), void *arg);
+void *alloc_shared(size_t size);
+
+/* calls func(arg) in a child process traced with ptrace, and counts the system
+ * calls made by it and by any threads it starts, less those of starting up and
+ * exiting. Requests submitted through io_uring don't count, only entering it.
+ * Returns -1 if the child can't be traced.
+ */
+long count_syscalls(void (*func)(void*), void *arg);
+
+#endif	// BENCHUTIL_H_
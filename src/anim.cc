@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <vector>
+#include "anim.h"
+#include "fstree.h"
+#include "arena.h"
+#include "curves.h"
+
+using namespace std;
+
+// where a node was before the layout changed it
+struct Record {
+	const FSNode *node;
+	uint32_t id;
+	Vector3 pos, size;
+};
+
+// a node on its way from one place to another
+struct Motion {
+	const FSNode *node;
+	uint32_t id;
+	Vector3 from_pos, from_size;
+	Vector3 to_pos, to_size;
+};
+
+static void init();
+static bool record_less(const Record &a, const Record &b);
+static bool record_same(const Record &a, const Record &b);
+static void record_change(const FSNode *node);
+static void record_subtree(const Dir *dir);
+static void add_motion(const FSNode *node, uint32_t id, const Vector3 &pos, const Vector3 &size);
+static void drop_freed();
+static void node_freed(const FSNode *node);
+
+static float anim_time = 0.4;
+static curve_t ease;
+static bool initialized;
+
+static NodeArena *arena;
+static vector<Record> records;
+static bool recording;
+
+/* The transition in progress. Every frame is one pass over the array, which
+ * writes straight into the columns of the arena.
+ */
+static vector<Motion> motions;
+static vector<Vector3> shown;	// where they were on screen before a layout
+static unsigned int start_time;
+static bool nodes_freed;
+
+
+void set_anim_time(float sec)
+{
+	anim_time = sec;
+}
+
+float get_anim_time()
+{
+	return anim_time;
+}
+
+/* Nodes in motion are where they are on screen, not where the layout put
+ * them, so they're put back first: the layout goes by where things were, to
+ * only move what changed.
+ */
+void begin_layout_change(Dir *root, bool full)
+{
+	if(anim_time <= 0.0) {
+		return;
+	}
+	init();
+
+	if(nodes_freed) {
+		drop_freed();
+	}
+
+	shown.resize(motions.size() * 2);
+	for(size_t i=0; i<motions.size(); i++) {
+		Motion *m = &motions[i];
+		NodePage *page = arena->get_page(m->id);
+		int idx = m->id & NODE_PAGE_MASK;
+
+		shown[i * 2] = page->vis_pos[idx];
+		shown[i * 2 + 1] = page->vis_size[idx];
+		page->vis_pos[idx] = m->to_pos;
+		page->vis_size[idx] = m->to_size;
+	}
+
+	arena = root->get_arena();
+	records.clear();
+	recording = true;
+
+	if(full) {
+		record_subtree(root);
+	} else {
+		set_layout_change_func(record_change);
+	}
+}
+
+/* Nodes which were moving already carry on from where they are on screen,
+ * towards wherever they're going now. A node recorded with no size is new,
+ * and grows in place.
+ */
+void end_layout_change(unsigned int msec)
+{
+	if(!recording) {
+		return;
+	}
+	set_layout_change_func(0);
+	recording = false;
+
+	if(records.empty()) {
+		// nothing changed, back to where they were
+		for(size_t i=0; i<motions.size(); i++) {
+			if(nodes_freed && arena->get_node(motions[i].id) != motions[i].node) {
+				continue;	// dropped by the next update
+			}
+			NodePage *page = arena->get_page(motions[i].id);
+			int idx = motions[i].id & NODE_PAGE_MASK;
+			page->vis_pos[idx] = shown[i * 2];
+			page->vis_size[idx] = shown[i * 2 + 1];
+		}
+		return;
+	}
+
+	// a node may be recorded twice, for its size and position, the first is right
+	stable_sort(records.begin(), records.end(), record_less);
+	records.erase(unique(records.begin(), records.end(), record_same), records.end());
+
+	vector<Motion> prev;
+	prev.swap(motions);
+
+	vector<bool> moving(records.size(), false);
+	for(size_t i=0; i<prev.size(); i++) {
+		if(nodes_freed && arena->get_node(prev[i].id) != prev[i].node) {
+			continue;
+		}
+		Record key;
+		key.node = prev[i].node;
+		vector<Record>::iterator it = lower_bound(records.begin(), records.end(), key, record_less);
+		if(it != records.end() && it->node == key.node) {
+			moving[it - records.begin()] = true;
+		}
+		add_motion(prev[i].node, prev[i].id, shown[i * 2], shown[i * 2 + 1]);
+	}
+
+	for(size_t i=0; i<records.size(); i++) {
+		if(moving[i]) {
+			continue;
+		}
+		Record *rec = &records[i];
+		if(nodes_freed && arena->get_node(rec->id) != rec->node) {
+			continue;
+		}
+		if(rec->size.x == 0.0 && rec->size.y == 0.0 && rec->size.z == 0.0) {
+			rec->pos = rec->node->get_vis_pos();
+		}
+		add_motion(rec->node, rec->id, rec->pos, rec->size);
+	}
+	records.clear();
+	nodes_freed = false;
+
+	start_time = msec;
+	update_anim(msec);
+}
+
+bool update_anim(unsigned int msec)
+{
+	if(motions.empty()) {
+		return false;
+	}
+	if(nodes_freed) {
+		drop_freed();
+	}
+
+	float t = (int)(msec - start_time) / 1000.0 / anim_time;
+	if(t < 0.0) t = 0.0;
+	if(t > 1.0) t = 1.0;
+	float s = curve_eval(&ease, t);
+
+	// component by component, Vector3 has no inline constructor
+	int count = (int)motions.size();
+	const Motion *m = &motions[0];
+	for(int i=0; i<count; i++) {
+		NodePage *page = arena->get_page(m[i].id);
+		int idx = m[i].id & NODE_PAGE_MASK;
+		Vector3 *pos = page->vis_pos + idx;
+		Vector3 *size = page->vis_size + idx;
+
+		pos->x = m[i].from_pos.x + (m[i].to_pos.x - m[i].from_pos.x) * s;
+		pos->y = m[i].from_pos.y + (m[i].to_pos.y - m[i].from_pos.y) * s;
+		pos->z = m[i].from_pos.z + (m[i].to_pos.z - m[i].from_pos.z) * s;
+		size->x = m[i].from_size.x + (m[i].to_size.x - m[i].from_size.x) * s;
+		size->y = m[i].from_size.y + (m[i].to_size.y - m[i].from_size.y) * s;
+		size->z = m[i].from_size.z + (m[i].to_size.z - m[i].from_size.z) * s;
+	}
+
+	if(t >= 1.0) {
+		// exactly where the layout put them
+		for(int i=0; i<count; i++) {
+			NodePage *page = arena->get_page(m[i].id);
+			int idx = m[i].id & NODE_PAGE_MASK;
+			page->vis_pos[idx] = m[i].to_pos;
+			page->vis_size[idx] = m[i].to_size;
+		}
+		motions.clear();
+		return false;
+	}
+	return true;
+}
+
+int get_anim_count()
+{
+	return (int)motions.size();
+}
+
+// eases in and out, following half a cosine wave
+static void init()
+{
+	if(initialized) {
+		return;
+	}
+	curve_cons(&ease);
+	curve_mode(&ease, CURVE_COS);
+	curve_value(&ease, 0.0, 0.0);
+	curve_value(&ease, 1.0, 1.0);
+
+	add_node_free_func(node_freed);
+	initialized = true;
+}
+
+static bool record_less(const Record &a, const Record &b)
+{
+	return a.node < b.node;
+}
+
+static bool record_same(const Record &a, const Record &b)
+{
+	return a.node == b.node;
+}
+
+static void record_change(const FSNode *node)
+{
+	Record rec;
+	rec.node = node;
+	rec.id = node->get_id();
+	rec.pos = node->get_vis_pos();
+	rec.size = node->get_vis_size();
+	records.push_back(rec);
+}
+
+static void record_subtree(const Dir *dir)
+{
+	record_change(dir);
+
+	int num_files = dir->get_num_files();
+	for(int i=0; i<num_files; i++) {
+		record_change(dir->get_file(i));
+	}
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		record_subtree(dir->get_subdir(i));
+	}
+}
+
+// adds a node to the transition, going from pos/size to where it is now
+static void add_motion(const FSNode *node, uint32_t id, const Vector3 &pos, const Vector3 &size)
+{
+	Motion m;
+	m.node = node;
+	m.id = id;
+	m.from_pos = pos;
+	m.from_size = size;
+	m.to_pos = node->get_vis_pos();
+	m.to_size = node->get_vis_size();
+
+	if(m.from_pos.x == m.to_pos.x && m.from_pos.y == m.to_pos.y && m.from_pos.z == m.to_pos.z &&
+			m.from_size.x == m.to_size.x && m.from_size.y == m.to_size.y &&
+			m.from_size.z == m.to_size.z) {
+		return;		// didn't move after all, see full in begin_layout_change
+	}
+	motions.push_back(m);
+}
+
+/* node ids are reused, so whether a node is still there is told by the arena
+ * still having the same node under its id
+ */
+static void drop_freed()
+{
+	size_t count = 0;
+	for(size_t i=0; i<motions.size(); i++) {
+		if(arena->get_node(motions[i].id) == motions[i].node) {
+			motions[count++] = motions[i];
+		}
+	}
+	motions.resize(count);
+	nodes_freed = false;
+}
+
+static void node_freed(const FSNode *node)
+{
+	if(!motions.empty() || recording) {
+		nodes_freed = true;
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef ANIM_H_
+#define ANIM_H_
+
+class Dir;
+
+/* Animated layout changes: instead of jumping to where the layout puts them,
+ * nodes move (and grow, if they're new) there over get_anim_time seconds.
+ * Every layout of the tree after the first goes between begin_layout_change
+ * and end_layout_change, which find out what moved. The nodes in motion are
+ * then kept in flat arrays, and update_anim moves all of them in one pass
+ * every frame.
+ */
+void set_anim_time(float sec);	// 0 turns animations off
+float get_anim_time();
+
+/* With full, the whole tree is compared before and after (for Dir::layout),
+ * otherwise the nodes are recorded as the layout moves them (for relayout).
+ */
+void begin_layout_change(Dir *root, bool full);
+void end_layout_change(unsigned int msec);
+
+/* moves the nodes to where they are at msec, returns true while some are
+ * still moving
+ */
+bool update_anim(unsigned int msec);
+
+// the nodes in motion, for benchmarks
+int get_anim_count();
+
+#endif	// ANIM_H_
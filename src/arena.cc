@@ -0,0 +1,573 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "arena.h"
+
+#define CHUNK_SIZE		(256 * 1024)
+#define GRAIN			8
+// anything larger than this comes straight from malloc
+#define MAX_BLOCK		512
+#define NUM_CLASSES		(MAX_BLOCK / GRAIN)
+
+#define BLOCK_SIZE(sz)	(((sz) + GRAIN - 1) & ~(size_t)(GRAIN - 1))
+#define SIZE_CLASS(sz)	(BLOCK_SIZE(sz) / GRAIN - 1)
+
+// what a thread takes at a time: part of a chunk, freed blocks of a size, ids
+#define REGION_SIZE		(16 * 1024)
+#define FREE_BATCH		32
+#define ID_BATCH		64
+
+/* interned names are preceded by their reference count */
+#define NAME_HDR		4
+#define NAME_REFS(str)	(*(uint32_t*)((str) - NAME_HDR))
+
+#define NAME_SHARD(hash)	((hash) >> 26)
+
+// longest a waiter spins between looks at the lock, before it yields instead
+#define MAX_SPINS		1024
+
+/* What a thread has taken from an arena, to allocate from without the lock.
+ * A thread only keeps one, for the arena it last allocated from, and hands
+ * it back before taking one from another arena.
+ */
+struct ThreadCache {
+	unsigned int serial;	// of the arena, 0 for none
+	char *top, *end;		// what's left of its region
+	void *free_lists[NUM_CLASSES];
+	uint32_t ids[ID_BATCH];
+	int num_ids;
+	long used;				// bytes handed out since it last came back
+};
+
+static inline void cpu_relax();
+static uint32_t hash_name(const char *s);
+
+static __thread ThreadCache tcache;
+
+// the arenas in existence, for threads to find the one their cache is from
+static std::vector<NodeArena*> arenas;
+static unsigned int last_serial;
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+NodeArena::NodeArena()
+	: inodes(this)
+{
+	top = end = 0;
+	free_lists = new void*[NUM_CLASSES];
+	memset(free_lists, 0, NUM_CLASSES * sizeof *free_lists);
+	lock = 0;
+	releasing = false;
+	num_used = 0;
+	memset(name_shards, 0, sizeof name_shards);
+	pages = 0;
+	num_pages = max_pages = 0;
+	next_id = 0;
+	id_limit = 0;
+
+	pthread_mutex_lock(&arenas_lock);
+	serial = ++last_serial;
+	arenas.push_back(this);
+	pthread_mutex_unlock(&arenas_lock);
+}
+
+NodeArena::~NodeArena()
+{
+	pthread_mutex_lock(&arenas_lock);
+	for(size_t i=0; i<arenas.size(); i++) {
+		if(arenas[i] == this) {
+			arenas.erase(arenas.begin() + i);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&arenas_lock);
+
+	// long names are the only ones which don't live in the chunks
+	for(int i=0; i<NAME_SHARDS; i++) {
+		NameShard *shard = name_shards + i;
+		for(size_t j=0; j<shard->size; j++) {
+			char *name = shard->names[j];
+			if(name && strlen(name) + 1 + NAME_HDR > MAX_BLOCK) {
+				::free(name - NAME_HDR);
+			}
+		}
+		delete [] shard->names;
+	}
+
+	for(size_t i=0; i<num_pages; i++) {
+		delete pages[i];
+	}
+	delete [] pages;
+	for(size_t i=0; i<old_pages.size(); i++) {
+		delete [] old_pages[i];
+	}
+
+	for(size_t i=0; i<chunks.size(); i++) {
+		::free(chunks[i]);
+	}
+	delete [] free_lists;
+}
+
+void *NodeArena::alloc(size_t size)
+{
+	ThreadCache *tc = &tcache;
+
+	if(size <= MAX_BLOCK && tc->serial == serial) {
+		size = BLOCK_SIZE(size);
+		void **head = tc->free_lists + SIZE_CLASS(size);
+		if(*head) {
+			void *ptr = *head;
+			*head = *(void**)ptr;
+			tc->used += size;
+			return ptr;
+		}
+		if(tc->top + size <= tc->end) {
+			void *ptr = tc->top;
+			tc->top += size;
+			tc->used += size;
+			return ptr;
+		}
+	}
+
+	if(tc->serial != serial) {
+		switch_cache(tc);
+	}
+
+	spin_lock(&lock);
+	void *ptr = refill(tc, size);
+	__sync_lock_release(&lock);
+	return ptr;
+}
+
+/* called with the lock held, when the cache of the thread has nothing left
+ * for a block of this size: takes a few of those freed earlier if there are
+ * any, or a new region, and returns the first block out of them
+ */
+void *NodeArena::refill(ThreadCache *tc, size_t size)
+{
+	if(size > MAX_BLOCK) {
+		return malloc(size);
+	}
+	size = BLOCK_SIZE(size);
+
+	num_used += tc->used;
+	tc->used = 0;
+
+	void **head = free_lists + SIZE_CLASS(size);
+	if(*head) {
+		void **tc_head = tc->free_lists + SIZE_CLASS(size);
+		for(int i=0; i<FREE_BATCH && *head; i++) {
+			void *ptr = *head;
+			*head = *(void**)ptr;
+			*(void**)ptr = *tc_head;
+			*tc_head = ptr;
+		}
+	} else {
+		// the rest of the old region is lost, less than MAX_BLOCK bytes
+		new_region(tc);
+	}
+
+	// at least one of the two has it now
+	void **tc_head = tc->free_lists + SIZE_CLASS(size);
+	void *ptr;
+	if(*tc_head) {
+		ptr = *tc_head;
+		*tc_head = *(void**)ptr;
+	} else {
+		ptr = tc->top;
+		tc->top += size;
+	}
+	num_used += size;
+	return ptr;
+}
+
+// called with the lock held, spare regions are at least MAX_BLOCK bytes
+void NodeArena::new_region(ThreadCache *tc)
+{
+	if(!spare.empty()) {
+		tc->top = spare.back().first;
+		tc->end = spare.back().second;
+		spare.pop_back();
+		return;
+	}
+
+	if(top + REGION_SIZE > end) {
+		// the rest of the current chunk is lost, less than REGION_SIZE bytes
+		char *chunk = (char*)malloc(CHUNK_SIZE);
+		if(!chunk) {
+			abort();
+		}
+		chunks.push_back(chunk);
+		top = chunk;
+		end = chunk + CHUNK_SIZE;
+	}
+	tc->top = top;
+	tc->end = top + REGION_SIZE;
+	top += REGION_SIZE;
+}
+
+/* hands the cache of the thread back to the arena it's from, if that's still
+ * around, and makes it one for this arena, empty
+ */
+void NodeArena::switch_cache(ThreadCache *tc)
+{
+	if(tc->serial) {
+		pthread_mutex_lock(&arenas_lock);
+		for(size_t i=0; i<arenas.size(); i++) {
+			if(arenas[i]->serial == tc->serial) {
+				arenas[i]->release_thread_cache();
+				break;
+			}
+		}
+		pthread_mutex_unlock(&arenas_lock);
+	}
+
+	memset(tc, 0, sizeof *tc);
+	tc->serial = serial;
+}
+
+void NodeArena::release_thread_cache()
+{
+	ThreadCache *tc = &tcache;
+	if(tc->serial != serial) {
+		return;
+	}
+
+	spin_lock(&lock);
+	return_cache(tc);
+	__sync_lock_release(&lock);
+
+	memset(tc, 0, sizeof *tc);
+}
+
+// called with the lock held
+void NodeArena::return_cache(ThreadCache *tc)
+{
+	num_used += tc->used;
+
+	for(int i=0; i<NUM_CLASSES; i++) {
+		void *ptr = tc->free_lists[i];
+		while(ptr) {
+			void *next = *(void**)ptr;
+			*(void**)ptr = free_lists[i];
+			free_lists[i] = ptr;
+			ptr = next;
+		}
+	}
+
+	if(tc->end - tc->top >= MAX_BLOCK) {
+		spare.push_back(std::make_pair(tc->top, tc->end));
+	}
+
+	free_ids.insert(free_ids.end(), tc->ids, tc->ids + tc->num_ids);
+}
+
+void NodeArena::free(void *ptr, size_t size)
+{
+	if(!ptr || (releasing && size <= MAX_BLOCK)) {
+		return;
+	}
+
+	spin_lock(&lock);
+	free_block(ptr, size);
+	__sync_lock_release(&lock);
+}
+
+// called with the lock held
+void NodeArena::free_block(void *ptr, size_t size)
+{
+	if(size > MAX_BLOCK) {
+		::free(ptr);
+		return;
+	}
+
+	void **head = free_lists + SIZE_CLASS(size);
+	*(void**)ptr = *head;
+	*head = ptr;
+	num_used -= BLOCK_SIZE(size);
+}
+
+const char *NodeArena::alloc_name(const char *name)
+{
+	uint32_t hash = hash_name(name);
+	NameShard *shard = name_shards + NAME_SHARD(hash);
+
+	spin_lock(&shard->lock);
+
+	if(shard->count * 4 >= shard->size * 3) {
+		grow_names(shard);
+	}
+
+	size_t mask = shard->size - 1;
+	size_t idx = hash & mask;
+	while(shard->names[idx]) {
+		if(strcmp(shard->names[idx], name) == 0) {
+			NAME_REFS(shard->names[idx])++;
+			__sync_lock_release(&shard->lock);
+			return shard->names[idx];
+		}
+		idx = (idx + 1) & mask;
+	}
+
+	size_t size = strlen(name) + 1 + NAME_HDR;
+	char *str = (char*)alloc(size) + NAME_HDR;
+	NAME_REFS(str) = 1;
+	strcpy(str, name);
+
+	shard->names[idx] = str;
+	shard->count++;
+	shard->bytes += size > MAX_BLOCK ? size : BLOCK_SIZE(size);
+
+	__sync_lock_release(&shard->lock);
+	return str;
+}
+
+void NodeArena::free_name(const char *name)
+{
+	if(!name || releasing) {
+		return;	// long names are freed with the table when releasing
+	}
+	uint32_t hash = hash_name(name);
+	NameShard *shard = name_shards + NAME_SHARD(hash);
+
+	spin_lock(&shard->lock);
+
+	if(--NAME_REFS(name) == 0) {
+		char **names = shard->names;
+		size_t mask = shard->size - 1;
+		size_t idx = hash & mask;
+		while(names[idx] != name) {
+			idx = (idx + 1) & mask;
+		}
+
+		/* shift back any entries of the same probe sequence which follow it,
+		 * so that lookups never stop at the hole
+		 */
+		size_t next = idx;
+		for(;;) {
+			next = (next + 1) & mask;
+			if(!names[next]) {
+				break;
+			}
+			size_t home = hash_name(names[next]) & mask;
+			if(((next - home) & mask) >= ((next - idx) & mask)) {
+				names[idx] = names[next];
+				idx = next;
+			}
+		}
+		names[idx] = 0;
+
+		size_t size = strlen(name) + 1 + NAME_HDR;
+		shard->count--;
+		shard->bytes -= size > MAX_BLOCK ? size : BLOCK_SIZE(size);
+		free((char*)name - NAME_HDR, size);
+	}
+
+	__sync_lock_release(&shard->lock);
+}
+
+// called with the lock of the shard held
+void NodeArena::grow_names(NameShard *shard)
+{
+	size_t new_size = shard->size ? shard->size * 2 : 64;
+	char **new_names = new char*[new_size];
+	memset(new_names, 0, new_size * sizeof *new_names);
+
+	for(size_t i=0; i<shard->size; i++) {
+		if(shard->names[i]) {
+			size_t idx = hash_name(shard->names[i]) & (new_size - 1);
+			while(new_names[idx]) {
+				idx = (idx + 1) & (new_size - 1);
+			}
+			new_names[idx] = shard->names[i];
+		}
+	}
+
+	delete [] shard->names;
+	shard->names = new_names;
+	shard->size = new_size;
+}
+
+uint32_t NodeArena::alloc_id(FSNode *node)
+{
+	ThreadCache *tc = &tcache;
+
+	if(tc->serial != serial || !tc->num_ids) {
+		if(tc->serial != serial) {
+			switch_cache(tc);
+		}
+		spin_lock(&lock);
+		refill_ids(tc);
+		__sync_lock_release(&lock);
+	}
+
+	uint32_t id = tc->ids[--tc->num_ids];
+	NodePage *page = get_page(id);
+	page->node[id & NODE_PAGE_MASK] = node;
+	page->live[id & NODE_PAGE_MASK] = 1;
+	return id;
+}
+
+/* called with the lock held: a batch of ids for the thread, those freed
+ * earlier first. They're taken from the back, lowest first.
+ */
+void NodeArena::refill_ids(ThreadCache *tc)
+{
+	while(tc->num_ids < ID_BATCH && !free_ids.empty()) {
+		tc->ids[tc->num_ids++] = free_ids.back();
+		free_ids.pop_back();
+	}
+	if(tc->num_ids < ID_BATCH) {
+		int count = ID_BATCH - tc->num_ids;
+		memmove(tc->ids + count, tc->ids, tc->num_ids * sizeof *tc->ids);
+		for(int i=count; i>0; i--) {
+			tc->ids[i - 1] = new_id();
+		}
+		tc->num_ids = ID_BATCH;
+	}
+
+	if(next_id != id_limit) {
+		__sync_synchronize();	// the page and the pages array before the limit
+		id_limit = next_id;
+	}
+}
+
+// called with the lock held
+uint32_t NodeArena::new_id()
+{
+	uint32_t id = next_id++;
+	if((id >> NODE_PAGE_SHIFT) >= num_pages) {
+		add_page();
+	}
+	return id;
+}
+
+void NodeArena::free_id(uint32_t id)
+{
+	if(releasing) {
+		return;
+	}
+
+	spin_lock(&lock);
+	NodePage *page = pages[id >> NODE_PAGE_SHIFT];
+	page->node[id & NODE_PAGE_MASK] = 0;
+	page->live[id & NODE_PAGE_MASK] = 0;
+	free_ids.push_back(id);
+	__sync_lock_release(&lock);
+}
+
+uint32_t NodeArena::get_id_limit() const
+{
+	uint32_t limit = id_limit;
+	__sync_synchronize();	// and the pages after it
+	return limit;
+}
+
+// called with the lock held
+void NodeArena::add_page()
+{
+	if(num_pages >= max_pages) {
+		size_t new_max = max_pages ? max_pages * 2 : 16;
+		NodePage **new_pages = new NodePage*[new_max];
+		for(size_t i=0; i<num_pages; i++) {
+			new_pages[i] = pages[i];
+		}
+		if(pages) {
+			old_pages.push_back((NodePage**)pages);
+		}
+		max_pages = new_max;
+		__sync_synchronize();
+		pages = new_pages;
+	}
+
+	NodePage *page = new NodePage;
+	memset(page->node, 0, sizeof page->node);
+	memset(page->live, 0, sizeof page->live);
+	pages[num_pages] = page;
+	__sync_synchronize();
+	num_pages++;
+}
+
+void NodeArena::begin_release()
+{
+	releasing = true;
+}
+
+bool NodeArena::is_releasing() const
+{
+	return releasing;
+}
+
+InodeSet *NodeArena::get_inodes()
+{
+	return &inodes;
+}
+
+size_t NodeArena::get_size() const
+{
+	return chunks.size() * CHUNK_SIZE;
+}
+
+size_t NodeArena::get_used() const
+{
+	return num_used;
+}
+
+size_t NodeArena::get_num_names() const
+{
+	size_t count = 0;
+	for(int i=0; i<NAME_SHARDS; i++) {
+		count += name_shards[i].count;
+	}
+	return count;
+}
+
+size_t NodeArena::get_name_bytes() const
+{
+	size_t bytes = 0;
+	for(int i=0; i<NAME_SHARDS; i++) {
+		bytes += name_shards[i].bytes + name_shards[i].size * sizeof *name_shards[i].names;
+	}
+	return bytes;
+}
+
+// FNV-1a
+static uint32_t hash_name(const char *s)
+{
+	uint32_t hash = 2166136261u;
+	while(*s) {
+		hash = (hash ^ (unsigned char)*s++) * 16777619u;
+	}
+	return hash;
+}
+
+/* Waiters only read the lock until it looks free, and back off further each
+ * time they find it taken, so they don't keep taking the cache line away from
+ * the thread which holds it. Past MAX_SPINS they yield the cpu: the holder may
+ * have been preempted, with more threads than cpus.
+ */
+void spin_lock(volatile int *lock)
+{
+	int spins = 1;
+	while(__sync_lock_test_and_set(lock, 1)) {
+		while(*lock) {
+			if(spins < MAX_SPINS) {
+				for(int i=0; i<spins; i++) {
+					cpu_relax();
+				}
+				spins <<= 1;
+			} else {
+				sched_yield();
+			}
+		}
+	}
+}
+
+static inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
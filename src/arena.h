@@ -0,0 +1,174 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include <utility>
+#include <vmath.h>
+#include "inodeset.h"
+
+#define NODE_PAGE_SHIFT		12
+#define NODE_PAGE_SIZE		(1 << NODE_PAGE_SHIFT)
+#define NODE_PAGE_MASK		(NODE_PAGE_SIZE - 1)
+
+#define NAME_SHARDS			64
+
+class FSNode;
+struct ThreadCache;
+
+/* The attributes of the nodes, stored by column for a page of node ids at a
+ * time, so that a pass over one attribute of the whole tree (totals, filters,
+ * color mapping) reads it contiguously instead of striding across nodes.
+ * Rows of unused ids have a null node and live flag, and hold garbage
+ * otherwise. Passes over the columns go by live, a byte per row.
+ */
+struct NodePage {
+	FSNode *node[NODE_PAGE_SIZE];	// 0 for unused ids
+	unsigned char live[NODE_PAGE_SIZE];	// 1 for ids in use
+	unsigned char kind[NODE_PAGE_SIZE];	// NodeKind, same as the node's
+	size_t size[NODE_PAGE_SIZE];
+	int mode[NODE_PAGE_SIZE];
+	int uid[NODE_PAGE_SIZE];
+	int gid[NODE_PAGE_SIZE];
+	int nlink[NODE_PAGE_SIZE];
+	uint64_t inode[NODE_PAGE_SIZE];	// key in the InodeSet, 0 if not tracked
+	uint32_t next_link[NODE_PAGE_SIZE];	// next link to the same inode, see InodeSet
+	time_t time[3][NODE_PAGE_SIZE];
+	Vector3 vis_pos[NODE_PAGE_SIZE];
+	Vector3 vis_size[NODE_PAGE_SIZE];
+};
+
+/* Memory for the nodes of a tree and their names. Blocks are carved out of
+ * large chunks, and freed blocks are kept in lists by size to be handed out
+ * again, so a tree of millions of entries takes a few hundred mallocs instead
+ * of two per entry, and without any per-block overhead. All of it goes back
+ * to the system at once when the arena is deleted.
+ *
+ * Names are interned: every distinct name is stored once per tree, with a
+ * reference count, and all nodes with that name point to the same string.
+ * Most names in a real tree repeat (Makefile, index.js, .git, __init__.py),
+ * and the pointer stays valid for as long as any node uses it.
+ *
+ * Every node also gets an id, its row in the attribute columns (see
+ * NodePage). Ids of freed nodes are handed out again.
+ *
+ * The inodes of directories and hard links are tracked here as well, being
+ * per tree (see InodeSet).
+ *
+ * Scanner threads allocate concurrently. Each thread takes a region of a
+ * chunk, a few freed blocks of the sizes it asks for, and a batch of ids at a
+ * time, and allocates from those without locking. Only getting more takes
+ * the lock of the arena, and so do frees. The name table is split in shards
+ * by hash, each with a lock of its own. Waiters back off, then yield (see
+ * spin_lock).
+ */
+class NodeArena {
+private:
+	std::vector<char*> chunks;
+	char *top, *end;
+	void **free_lists;
+	volatile int lock;
+	bool releasing;
+	size_t num_used;	// as of the last time the threads came back for more
+	unsigned int serial;	// tells the arenas apart in the thread caches
+	// what was left of the regions of threads which were done with them
+	std::vector<std::pair<char*, char*> > spare;
+
+	/* open addressing with linear probing. Hashes aren't kept, they're cheap
+	 * to compute again for short strings, and most probes fail on the first
+	 * character anyway.
+	 */
+	struct NameShard {
+		char **names;
+		size_t size, count;
+		size_t bytes;
+		volatile int lock;
+	};
+	NameShard name_shards[NAME_SHARDS];
+
+	/* Pages never move once allocated. When the page table grows, the old
+	 * one is kept until the arena is deleted, so that other threads can go on
+	 * reading through it without taking the lock.
+	 */
+	NodePage **volatile pages;
+	size_t num_pages, max_pages;
+	std::vector<NodePage**> old_pages;
+	uint32_t next_id;
+	/* next_id as seen by readers without the lock, only moved past an id
+	 * once the page it's in is installed
+	 */
+	volatile uint32_t id_limit;
+	std::vector<uint32_t> free_ids;
+
+	InodeSet inodes;
+
+	void free_block(void *ptr, size_t size);
+	void *refill(ThreadCache *tc, size_t size);
+	void new_region(ThreadCache *tc);
+	void refill_ids(ThreadCache *tc);
+	void switch_cache(ThreadCache *tc);
+	void return_cache(ThreadCache *tc);
+	void grow_names(NameShard *shard);
+	void add_page();
+	uint32_t new_id();
+
+public:
+	NodeArena();
+	~NodeArena();
+
+	void *alloc(size_t size);
+	// size must be the one it was allocated with
+	void free(void *ptr, size_t size);
+
+	// returns the interned copy of a name, each call must be matched by a free_name
+	const char *alloc_name(const char *name);
+	void free_name(const char *name);
+
+	uint32_t alloc_id(FSNode *node);
+	void free_id(uint32_t id);
+	/* all ids ever handed out are below this, and so are their pages. Safe to
+	 * call without the lock, while other threads allocate: passes over the
+	 * columns go up to it, through get_page.
+	 */
+	uint32_t get_id_limit() const;
+
+	NodePage *get_page(uint32_t id) const
+	{
+		return pages[id >> NODE_PAGE_SHIFT];
+	}
+
+	FSNode *get_node(uint32_t id) const
+	{
+		return pages[id >> NODE_PAGE_SHIFT]->node[id & NODE_PAGE_MASK];
+	}
+
+	/* called before deleting the arena along with everything in it: from
+	 * then on frees do nothing, instead of filling the free lists for nobody
+	 */
+	void begin_release();
+	bool is_releasing() const;
+
+	InodeSet *get_inodes();
+
+	/* hands back what the calling thread took to allocate from without the
+	 * lock, for threads which are done with the arena. Threads which aren't
+	 * get it back when they go on to allocate from another arena.
+	 */
+	void release_thread_cache();
+
+	// bytes allocated from the system, and handed out to the tree
+	size_t get_size() const;
+	size_t get_used() const;
+	// distinct names, and bytes used for them, including the table
+	size_t get_num_names() const;
+	size_t get_name_bytes() const;
+};
+
+/* takes a spinlock: the arena's own, or one of those of the InodeSet.
+ * Waiters back off, then yield the cpu, instead of hammering it.
+ */
+void spin_lock(volatile int *lock);
+
+#endif	// ARENA_H_
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "snapshot.h"
+
+const char *get_cache_path(const char *dirname)
+{
+	static char buf[PATH_MAX + 64];
+	char path[PATH_MAX];
+	const char *env;
+
+	if(!realpath(dirname, path)) {
+		return 0;
+	}
+
+	// FNV-1a of the absolute path
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(const char *s=path; *s; s++) {
+		hash = (hash ^ (unsigned char)*s) * 0x100000001b3ULL;
+	}
+
+	if((env = getenv("XDG_CACHE_HOME")) && *env) {
+		snprintf(buf, sizeof buf, "%s/fsnav/%016llx.cache", env, (unsigned long long)hash);
+	} else if((env = getenv("HOME")) && *env) {
+		snprintf(buf, sizeof buf, "%s/.cache/fsnav/%016llx.cache", env, (unsigned long long)hash);
+	} else {
+		return 0;
+	}
+	return buf;
+}
+
+static void make_dirs(char *path)
+{
+	for(char *s=path + 1; *s; s++) {
+		if(*s == '/') {
+			*s = 0;
+			mkdir(path, 0755);
+			*s = '/';
+		}
+	}
+}
+
+bool save_cache(const Dir *tree, const char *fname)
+{
+	char path[PATH_MAX + 64];
+	snprintf(path, sizeof path, "%s", fname);
+	make_dirs(path);
+
+	return write_snapshot(tree, fname);
+}
+
+Dir *load_cache(const char *fname)
+{
+	if(access(fname, F_OK) == -1) {
+		return 0;
+	}
+
+	Snapshot snap;
+	if(!snap.open(fname)) {
+		fprintf(stderr, "ignoring scan cache: %s\n", fname);
+		return 0;
+	}
+	return snap.create_tree(0);
+}
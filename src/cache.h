@@ -0,0 +1,21 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+class Dir;
+
+/* The scan cache keeps the tree of a directory between runs, as a tree
+ * snapshot (see snapshot.h) which is turned back into a tree in one pass.
+ * A loaded tree is brought up to date with refresh_tree or start_refresh,
+ * which only read again the directories which changed since it was saved.
+ */
+
+/* path of the cache file for a directory, in $XDG_CACHE_HOME/fsnav or
+ * ~/.cache/fsnav. Returns a static buffer, or 0 if there's no home dir.
+ */
+const char *get_cache_path(const char *dirname);
+
+bool save_cache(const Dir *tree, const char *fname);
+// returns 0 if the cache is missing, corrupt, or written by another version
+Dir *load_cache(const char *fname);
+
+#endif	// CACHE_H_
@@ -12,7 +12,7 @@ static const Vector3 file_color[] = {
 
 Vector3 get_color(const FSNode *node)
 {
-	if(dynamic_cast<const Dir*>(node)) {
+	if(node->is_dir()) {
 		return dir_color[node->selected ? 1 : 0];
 	}
 	return file_color[node->selected ? 1 : 0];
@@ -0,0 +1,84 @@
+#include <string.h>
+#include <fnmatch.h>
+#include "exclude.h"
+
+enum {
+	PAT_EXACT,
+	PAT_PREFIX,		// literal*
+	PAT_SUFFIX,		// *literal
+	PAT_GLOB
+};
+
+static bool is_literal(const char *s, const char *end);
+
+void ExcludeList::add(const char *glob)
+{
+	Pattern pat;
+	const char *end = glob + strlen(glob);
+
+	if(is_literal(glob, end)) {
+		pat.type = PAT_EXACT;
+		pat.str = glob;
+	} else if(end > glob + 1 && *glob == '*' && is_literal(glob + 1, end)) {
+		pat.type = PAT_SUFFIX;
+		pat.str = glob + 1;
+	} else if(end > glob + 1 && end[-1] == '*' && is_literal(glob, end - 1)) {
+		pat.type = PAT_PREFIX;
+		pat.str.assign(glob, end - 1);
+	} else {
+		pat.type = PAT_GLOB;
+		pat.str = glob;
+	}
+	patterns.push_back(pat);
+}
+
+void ExcludeList::clear()
+{
+	patterns.clear();
+}
+
+bool ExcludeList::match(const char *name) const
+{
+	size_t len = strlen(name);
+
+	for(size_t i=0; i<patterns.size(); i++) {
+		const Pattern &pat = patterns[i];
+		size_t plen = pat.str.size();
+
+		switch(pat.type) {
+		case PAT_EXACT:
+			if(len == plen && memcmp(name, pat.str.data(), len) == 0) {
+				return true;
+			}
+			break;
+
+		case PAT_PREFIX:
+			if(len >= plen && memcmp(name, pat.str.data(), plen) == 0) {
+				return true;
+			}
+			break;
+
+		case PAT_SUFFIX:
+			if(len >= plen && memcmp(name + len - plen, pat.str.data(), plen) == 0) {
+				return true;
+			}
+			break;
+
+		default:
+			if(fnmatch(pat.str.c_str(), name, 0) == 0) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool is_literal(const char *s, const char *end)
+{
+	while(s < end) {
+		if(strchr("*?[\\", *s++)) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+#ifndef EXCLUDE_H_
+#define EXCLUDE_H_
+
+#include <string>
+#include <vector>
+
+/* A list of shell globs matched against the names of directory entries (not
+ * their paths), checked for every entry the scanner reads. Most patterns in
+ * practice are plain names (.git, node_modules), or a name with a single *
+ * at either end (*.o, core.*), which are matched with a length check and a
+ * memcmp. Only the rest go through fnmatch.
+ */
+class ExcludeList {
+private:
+	struct Pattern {
+		int type;
+		std::string str;	// the literal part, or the whole glob for fnmatch
+	};
+	std::vector<Pattern> patterns;
+
+public:
+	void add(const char *glob);
+	void clear();
+
+	bool empty() const { return patterns.empty(); }
+	bool match(const char *name) const;
+};
+
+#endif	// EXCLUDE_H_
@@ -0,0 +1,294 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "filegeom.h"
+#include "fstree.h"
+#include "arena.h"
+
+// the percentiles go by a histogram of log2 of the values, 4 buckets per octave
+#define NUM_BUCKETS		256
+#define BUCKET_DIV		4
+
+// smallest footprint, as a fraction of LP_FILE_SIZE
+#define MIN_FOOTPRINT	0.25f
+
+struct Range {
+	float max;				// largest size, or oldest age in seconds
+	float inv_max, inv_log_max;
+	float cdf[NUM_BUCKETS];	// fraction of the files up to the middle of each bucket
+};
+
+static void find_ranges(NodeArena *arena);
+static void get_inputs(const NodePage *page, int start, int count, int attr, float *in);
+static void map_values(int dim, const float *in, float *out, int count);
+static void calc_cdf(Range *r, const size_t *hist);
+static inline bool is_file(const NodePage *page, int idx);
+static inline int bucket(float x);
+static inline float approx_log2(float x);
+
+
+static int func[2] = {GEOM_LOG, GEOM_FIXED};
+static int attr[2] = {GEOM_BY_SIZE, GEOM_BY_SIZE};
+static Range range[2];	// by attribute
+static time_t now;
+
+static const char *func_names[] = {"fixed", "linear", "sqrt", "log", "percentile"};
+
+// scratch for update_file_geom, a page at a time
+static float in_buf[NODE_PAGE_SIZE];
+static float val_buf[2][NODE_PAGE_SIZE];
+
+
+void set_file_geom(int dim, int f, int a)
+{
+	func[dim] = f;
+	attr[dim] = a;
+}
+
+int get_file_geom_func(int dim)
+{
+	return func[dim];
+}
+
+int get_file_geom_attr(int dim)
+{
+	return attr[dim];
+}
+
+const char *get_file_geom_name(int f)
+{
+	return func_names[f];
+}
+
+void update_file_geom(Dir *root)
+{
+	NodeArena *arena = root->get_arena();
+	find_ranges(arena);
+
+	float hmin = get_layout_param(LP_FILE_HEIGHT);
+	float hrange = get_layout_param(LP_FILE_MAX_HEIGHT);
+	float fmax = get_layout_param(LP_FILE_SIZE);
+	float fmin = fmax * MIN_FOOTPRINT;
+	// the treemap has footprints of its own, by size
+	bool footprint = get_layout_engine() != LAYOUT_TREEMAP;
+
+	/* scanner threads may be adding nodes meanwhile, the limit only covers
+	 * pages which are there already. Their new rows are skipped for having no
+	 * size yet, or set again when the nodes are placed.
+	 */
+	uint32_t limit = arena->get_id_limit();
+	for(uint32_t base=0; base<limit; base+=NODE_PAGE_SIZE) {
+		NodePage *page = arena->get_page(base);
+		int count = limit - base < NODE_PAGE_SIZE ? limit - base : NODE_PAGE_SIZE;
+
+		for(int i=0; i<2; i++) {
+			get_inputs(page, 0, count, attr[i], in_buf);
+			map_values(i, in_buf, val_buf[i], count);
+		}
+
+		for(int i=0; i<count; i++) {
+			// files which weren't placed yet have no size, the layout gets to them
+			if(!is_file(page, i) || page->vis_size[i].y <= 0) {
+				continue;
+			}
+			Vector3 &pos = page->vis_pos[i];
+			Vector3 &size = page->vis_size[i];
+
+			float bottom = pos.y - size.y * 0.5f;
+			size.y = hmin + val_buf[GEOM_HEIGHT][i] * hrange;
+			if(footprint) {
+				size.x = size.z = fmin + val_buf[GEOM_FOOTPRINT][i] * (fmax - fmin);
+			}
+			pos.y = bottom + size.y * 0.5f;
+		}
+	}
+}
+
+void calc_file_geom(const File *file, float *height, float *footprint)
+{
+	uint32_t id = file->get_id();
+	const NodePage *page = file->get_arena()->get_page(id);
+	int idx = id & NODE_PAGE_MASK;
+
+	float in, val[2];
+	for(int i=0; i<2; i++) {
+		get_inputs(page, idx, 1, attr[i], &in);
+		map_values(i, &in, val + i, 1);
+	}
+
+	float fmax = get_layout_param(LP_FILE_SIZE);
+	float fmin = fmax * MIN_FOOTPRINT;
+	*height = get_layout_param(LP_FILE_HEIGHT) + val[GEOM_HEIGHT] * get_layout_param(LP_FILE_MAX_HEIGHT);
+	*footprint = fmin + val[GEOM_FOOTPRINT] * (fmax - fmin);
+}
+
+/* the largest size and oldest age of the files, and their histograms if
+ * anything is mapped by percentile. Files which were never stat'ed (lazy
+ * scans) have no time, and count as the oldest.
+ */
+static void find_ranges(NodeArena *arena)
+{
+	static size_t hist[2][NUM_BUCKETS];
+	bool need_hist = func[GEOM_HEIGHT] == GEOM_PERCENTILE || func[GEOM_FOOTPRINT] == GEOM_PERCENTILE;
+
+	now = time(0);
+	size_t max_size = 0;
+	time_t oldest = now;
+	size_t num_untimed = 0;
+	memset(hist, 0, sizeof hist);
+
+	uint32_t limit = arena->get_id_limit();
+	for(uint32_t base=0; base<limit; base+=NODE_PAGE_SIZE) {
+		const NodePage *page = arena->get_page(base);
+		int count = limit - base < NODE_PAGE_SIZE ? limit - base : NODE_PAGE_SIZE;
+
+		for(int i=0; i<count; i++) {
+			if(!is_file(page, i)) continue;
+
+			size_t sz = page->size[i];
+			time_t t = page->time[MTIME][i];
+			if(sz > max_size) max_size = sz;
+			if(t && t < oldest) oldest = t;
+
+			if(need_hist) {
+				hist[GEOM_BY_SIZE][bucket((float)sz)]++;
+				if(t) {
+					hist[GEOM_BY_AGE][bucket(t < now ? (float)(now - t) : 0.0f)]++;
+				} else {
+					num_untimed++;
+				}
+			}
+		}
+	}
+
+	range[GEOM_BY_SIZE].max = (float)max_size;
+	range[GEOM_BY_AGE].max = (float)(now - oldest);
+	hist[GEOM_BY_AGE][bucket(range[GEOM_BY_AGE].max)] += num_untimed;
+
+	for(int i=0; i<2; i++) {
+		Range *r = range + i;
+		r->inv_max = r->max > 0 ? 1.0f / r->max : 0;
+		r->inv_log_max = r->max > 0 ? 1.0f / approx_log2(r->max + 1.0f) : 0;
+		if(need_hist) {
+			calc_cdf(r, hist[i]);
+		}
+	}
+}
+
+static void get_inputs(const NodePage *page, int start, int count, int attr, float *in)
+{
+	if(attr == GEOM_BY_SIZE) {
+		const size_t *size = page->size + start;
+		for(int i=0; i<count; i++) {
+			in[i] = (float)size[i];
+		}
+	} else {
+		const time_t *mtime = page->time[MTIME] + start;
+		float max_age = range[GEOM_BY_AGE].max;
+		for(int i=0; i<count; i++) {
+			float age = (float)(now - mtime[i]);
+			in[i] = mtime[i] ? (age > 0 ? age : 0) : max_age;
+		}
+	}
+}
+
+/* the mapping itself, between 0 and 1. Each function is its own loop over
+ * contiguous arrays, without calls into libm other than sqrtf, which the
+ * compiler vectorizes.
+ */
+static void map_values(int dim, const float *in, float *out, int count)
+{
+	const Range *r = range + attr[dim];
+	float inv_max = r->inv_max;
+	float inv_log_max = r->inv_log_max;
+
+	switch(func[dim]) {
+	case GEOM_LINEAR:
+		for(int i=0; i<count; i++) {
+			out[i] = in[i] * inv_max;
+		}
+		break;
+
+	case GEOM_SQRT:
+		for(int i=0; i<count; i++) {
+			out[i] = sqrtf(in[i] * inv_max);
+		}
+		break;
+
+	case GEOM_LOG:
+		for(int i=0; i<count; i++) {
+			out[i] = approx_log2(in[i] + 1.0f) * inv_log_max;
+		}
+		break;
+
+	case GEOM_PERCENTILE:
+		for(int i=0; i<count; i++) {
+			out[i] = r->cdf[bucket(in[i])];
+		}
+		break;
+
+	default:
+		// the smallest height, and the whole footprint
+		for(int i=0; i<count; i++) {
+			out[i] = dim == GEOM_FOOTPRINT ? 1.0f : 0.0f;
+		}
+		return;
+	}
+
+	for(int i=0; i<count; i++) {
+		float v = out[i] < 0.0f ? 0.0f : out[i];
+		out[i] = v > 1.0f ? 1.0f : v;
+	}
+	if(attr[dim] == GEOM_BY_AGE) {
+		for(int i=0; i<count; i++) {
+			out[i] = 1.0f - out[i];
+		}
+	}
+}
+
+static void calc_cdf(Range *r, const size_t *hist)
+{
+	size_t total = 0;
+	for(int i=0; i<NUM_BUCKETS; i++) {
+		total += hist[i];
+	}
+	if(!total) {
+		memset(r->cdf, 0, sizeof r->cdf);
+		return;
+	}
+
+	size_t below = 0;
+	for(int i=0; i<NUM_BUCKETS; i++) {
+		r->cdf[i] = (below + hist[i] * 0.5) / total;
+		below += hist[i];
+	}
+}
+
+// ids which aren't in use aren't live, see NodePage
+static inline bool is_file(const NodePage *page, int idx)
+{
+	return page->live[idx] && page->kind[idx] == KIND_FILE;
+}
+
+static inline int bucket(float x)
+{
+	int b = (int)(approx_log2(x + 1.0f) * BUCKET_DIV);
+	return b < NUM_BUCKETS ? b : NUM_BUCKETS - 1;
+}
+
+/* log2 of x >= 1 to within 0.001: the exponent, and a cubic through the
+ * mantissa, exact at both ends. Plenty for sizing boxes, and unlike log2f it
+ * vectorizes.
+ */
+static inline float approx_log2(float x)
+{
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof bits);
+	float e = (float)(int)((bits >> 23) - 127);
+
+	bits = (bits & 0x7fffff) | 0x3f800000;
+	float t;
+	memcpy(&t, &bits, sizeof t);
+	t -= 1.0f;
+	return e + t * (1.4208645f + t * (-0.5772507f + t * 0.1563861f));
+}
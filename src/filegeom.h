@@ -0,0 +1,46 @@
+#ifndef FILEGEOM_H_
+#define FILEGEOM_H_
+
+class Dir;
+class File;
+
+/* How the boxes of the files are sized: their height and their footprint each
+ * map an attribute of the file (its size, or its age) through one of these,
+ * onto the range of that attribute in the tree. Height goes from
+ * LP_FILE_HEIGHT up to LP_FILE_HEIGHT + LP_FILE_MAX_HEIGHT, footprint from a
+ * quarter of LP_FILE_SIZE up to all of it, and newer files get the larger end.
+ * Fixed is the smallest height, and the whole footprint. The treemap layout
+ * gives the files footprints of its own, by size, and only maps the height.
+ */
+enum {
+	GEOM_FIXED,
+	GEOM_LINEAR,
+	GEOM_SQRT,
+	GEOM_LOG,
+	GEOM_PERCENTILE,	// rank among all the files of the tree
+
+	NUM_GEOM_FUNCS
+};
+
+enum { GEOM_HEIGHT, GEOM_FOOTPRINT };
+enum { GEOM_BY_SIZE, GEOM_BY_AGE };
+
+void set_file_geom(int dim, int func, int attr);
+int get_file_geom_func(int dim);
+int get_file_geom_attr(int dim);
+const char *get_file_geom_name(int func);
+
+/* Finds the ranges of the sizes and ages of all the files of the tree (and how
+ * they're spread out, for percentiles), then sizes the boxes of all the files
+ * already placed, in place, keeping them on their directory. Both are passes
+ * over the attribute columns of the arena, page by page, not over the tree:
+ * this is what runs again when the mapping changes, or the tree has grown.
+ */
+void update_file_geom(Dir *root);
+
+/* height and footprint of a single file, by the ranges found by the last
+ * update_file_geom, for the layout
+ */
+void calc_file_geom(const File *file, float *height, float *footprint);
+
+#endif	// FILEGEOM_H_
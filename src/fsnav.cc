@@ -1,5 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <limits.h>
+#include <time.h>
+#include <vector>
+#include <set>
 #include "fstree.h"
 
 #if defined(__APPLE__) && defined(__MACH__)
@@ -15,6 +22,13 @@
 #include "vis.h"
 #include "image.h"
 #include "stereo.h"
+#include "scan.h"
+#include "watch.h"
+#include "cache.h"
+#include "snapshot.h"
+#include "idnames.h"
+#include "anim.h"
+#include "filegeom.h"
 
 #ifndef GL_BGRA
 #define GL_BGRA		0x80e1
@@ -24,6 +38,10 @@
 #define PREFIX	"/usr/local"
 #endif
 
+#define WATCH_POLL_INTERVAL		250
+// levels of a snapshot created up front, when no scan depth is given
+#define SNAP_DEPTH				4
+
 const char *find_data_file(const char *fname);
 void disp();
 void render();
@@ -35,8 +53,24 @@ void mouse(int bn, int state, int x, int y);
 void motion(int x, int y);
 void passive_motion(int x, int y);
 void double_click(int x, int y);
+void expand(Dir *dir);
+void expand_near(const Vector3 &pos, float dist);
+void find_stubs(Dir *dir);
+void dir_attached(Dir *dir);
+void update_layout();
+void update_file_boxes();
+void next_file_geom(int dim, bool next_attr);
+void next_layout_engine();
+void poll_scan(int val);
+void start_polling_scan();
+void poll_watch(int val);
+void node_removed(const FSNode *node);
+void save_tree();
+int scan_to_snapshot();
 unsigned int load_texture(const char *fname);
 int parse_args(int argc, char **argv);
+int glut_option_args(const char *opt);
+bool parse_layout_engine(const char *name);
 
 static float cam_theta = 0, cam_phi = 25, cam_dist = 5;
 static float cam_y = 0;
@@ -52,20 +86,41 @@ static int xsz, ysz;
 static FSNode *clicked_node;
 static bool hover_file_info;
 
-unsigned int fontrm, fonttt, fonttt_sm;
-unsigned int scope_tex;
-
 static char *root_dirname;
 static int stereo;
+static bool live;
+static bool use_cache;
+static char *cache_fname;
+static bool cache_dirty;
+static char *snap_fname;
+static char *out_fname;
+static Snapshot *snap;
+
+/* directories left unexpanded by the depth budget, kept up to date as scans
+ * attach directories, and as they're expanded or freed. The ones skipped by
+ * the scan policy aren't in it, they're only expanded by double-clicking.
+ */
+static std::set<Dir*> stubs;
+static bool polling_scan;
+static unsigned int last_layout_time, layout_interval;
+static unsigned int rate_time;
+static long rate_count;
+static float scan_rate;	// entries per second
 
 int main(int argc, char **argv)
 {
-	glutInitWindowSize(800, 600);
-	glutInit(&argc, argv);
-
+	/* parsed before glutInit, skipping its own options, since writing a
+	 * snapshot needs no display, and GLUT isn't even initialized for it
+	 */
 	if(parse_args(argc, argv) == -1) {
 		return 1;
 	}
+	if(out_fname) {
+		return scan_to_snapshot();
+	}
+
+	glutInitWindowSize(800, 600);
+	glutInit(&argc, argv);
 
 	glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE | (stereo ? GLUT_STEREO : 0));
 	glutCreateWindow("filesystem visualizer");
@@ -86,17 +141,57 @@ int main(int argc, char **argv)
 	set_layout_param(LP_FILE_SIZE, 0.5);
 	set_layout_param(LP_FILE_SPACING, 0.1);
 	set_layout_param(LP_FILE_HEIGHT, 0.1);
+	set_layout_param(LP_FILE_MAX_HEIGHT, 2.0);
 
 	set_layout_param(LP_DIR_SIZE, 0.5 + 0.2);
 	set_layout_param(LP_DIR_SPACING, 0.5);
 	set_layout_param(LP_DIR_HEIGHT, 0.1);
 	set_layout_param(LP_DIR_DIST, 5.0);
 
-	root = new Dir;
-	if(!build_tree(root, root_dirname)) {
-		return 1;
+	if(snap_fname) {
+		snap = new Snapshot;
+		if(!snap->open(snap_fname)) {
+			return 1;
+		}
+		root = snap->create_tree(get_scan_depth() ? get_scan_depth() : SNAP_DEPTH);
+		root->layout();
+		update_file_geom(root);
+		find_stubs(root);
+	} else if(live && init_watch()) {
+		glutTimerFunc(WATCH_POLL_INTERVAL, poll_watch, 0);
+	}
+
+	add_node_free_func(node_removed);
+	add_scan_attach_func(dir_attached);
+
+	if(use_cache && !snap) {
+		const char *fname = get_cache_path(root_dirname);
+		if(fname) {
+			cache_fname = strdup(fname);
+			root = load_cache(cache_fname);
+		}
+		atexit(save_tree);
+	}
+
+	/* the tree is scanned in the background and grows on screen as the
+	 * scanner finds things, see poll_scan. A cached tree is shown right away,
+	 * and brought up to date the same way.
+	 */
+	if(!snap) {
+		if(root) {
+			root->set_name(root_dirname);
+			start_refresh(root);
+		} else {
+			root = new Dir;
+			if(!start_scan(root, root_dirname)) {
+				return 1;
+			}
+		}
+		root->layout();
+		update_file_geom(root);
+		find_stubs(root);
+		start_polling_scan();
 	}
-	root->layout();
 
 	if(!(fontrm = create_font(find_data_file("kerkis.pfb"), 32))) {
 		return 1;
@@ -167,6 +262,10 @@ void disp()
 	}
 	Vector3 cam_pos = lerp(cam_from, cam_targ, t);
 
+	bool anim = update_anim(msec);
+
+	expand_near(cam_pos, cam_dist + get_layout_param(LP_DIR_DIST) * 2.0);
+
 	if(stereo) {
 		glDrawBuffer(GL_BACK_LEFT);
 	}
@@ -210,7 +309,7 @@ void disp()
 	glutSwapBuffers();
 	assert(glGetError() == GL_NO_ERROR);
 
-	if(t < 1.0) {
+	if(t < 1.0 || anim) {
 		glutPostRedisplay();
 	}
 }
@@ -229,10 +328,18 @@ void render()
 			sel = clicked_node;
 		}
 
-		if(dynamic_cast<File*>(sel)) {
-			draw_file_stats((File*)sel);
+		if(!sel->is_dir()) {
+			File *file = (File*)sel;
+			if(!file->have_stat() && !file->is_stat_failed()) {
+				stat_file(file);	// not filled in by the background pass yet
+			}
+			draw_file_stats(file);
 		}
 	}
+
+	if(polling_scan) {
+		draw_scan_progress(get_scan_count(), scan_rate);
+	}
 }
 
 Ray calc_mouse_ray(int x, int y)
@@ -282,6 +389,20 @@ void keyb(unsigned char key, int x, int y)
 		glutPostRedisplay();
 		break;
 
+	case 'h':
+	case 'H':
+		next_file_geom(GEOM_HEIGHT, key == 'H');
+		break;
+
+	case 'f':
+	case 'F':
+		next_file_geom(GEOM_FOOTPRINT, key == 'F');
+		break;
+
+	case 'm':
+		next_layout_engine();
+		break;
+
 	default:
 		break;
 	}
@@ -296,6 +417,7 @@ void keyb_up(unsigned char key, int x, int y)
 }
 
 #define DOUBLE_CLICK_INTERVAL	400
+#define SCAN_POLL_INTERVAL		50
 static int bnstate[16];
 
 static int prev_x = -1, prev_y;
@@ -390,6 +512,10 @@ void double_click(int x, int y)
 	FSNode *selnode = get_selection();
 
 	if(selnode) {
+		if(selnode->is_dir()) {
+			expand((Dir*)selnode);
+		}
+
 		cam_from = cam_targ;
 		cam_targ = selnode->get_vis_pos();
 		cam_motion_start = glutGet(GLUT_ELAPSED_TIME);
@@ -397,6 +523,237 @@ void double_click(int x, int y)
 	}
 }
 
+/* starts scanning a stub directory in the background, or with a snapshot
+ * creates its contents right away.
+ */
+void expand(Dir *dir)
+{
+	if(dir->is_expanded()) {
+		return;
+	}
+
+	if(snap) {
+		if(snap->expand(dir, get_scan_depth() ? get_scan_depth() : SNAP_DEPTH)) {
+			stubs.erase(dir);
+			update_layout();
+			find_stubs(dir);
+			glutPostRedisplay();
+		}
+		return;
+	}
+
+	// the stubs under it are added as the scan attaches them
+	if(scan_async(dir)) {
+		stubs.erase(dir);
+		start_polling_scan();
+	}
+}
+
+// expands the depth budget stubs within some distance of the camera target
+void expand_near(const Vector3 &pos, float dist)
+{
+	// expanding changes the set, so the ones in range are picked out first
+	std::vector<Dir*> near;
+	std::set<Dir*>::iterator it = stubs.begin();
+	while(it != stubs.end()) {
+		Dir *dir = *it++;
+		if((dir->get_vis_pos() - pos).length() < dist) {
+			near.push_back(dir);
+		}
+	}
+
+	for(size_t i=0; i<near.size(); i++) {
+		expand(near[i]);
+	}
+}
+
+// adds the stubs of a subtree, walking it down to them
+void find_stubs(Dir *dir)
+{
+	if(!dir->is_expanded()) {
+		if(!dir->is_skipped()) {
+			stubs.insert(dir);
+		}
+		return;
+	}
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		find_stubs(dir->get_subdir(i));
+	}
+}
+
+void dir_attached(Dir *dir)
+{
+	if(!dir->is_expanded() && !dir->is_skipped()) {
+		stubs.insert(dir);
+	}
+}
+
+void start_polling_scan()
+{
+	if(!polling_scan) {
+		glutTimerFunc(SCAN_POLL_INTERVAL, poll_scan, 0);
+		polling_scan = true;
+
+		rate_time = glutGet(GLUT_ELAPSED_TIME);
+		rate_count = get_scan_count();
+		scan_rate = 0;
+	}
+}
+
+// lays out whatever changed in the tree, moving things into place gradually
+void update_layout()
+{
+	begin_layout_change(root, false);
+	root->relayout();
+	end_layout_change(glutGet(GLUT_ELAPSED_TIME));
+}
+
+// sizes the file boxes again, by the current mapping and the ranges in the tree
+void update_file_boxes()
+{
+	begin_layout_change(root, true);
+	update_file_geom(root);
+	end_layout_change(glutGet(GLUT_ELAPSED_TIME));
+	glutPostRedisplay();
+}
+
+// switches to the next mapping of a dimension of the file boxes, or the other attribute
+void next_file_geom(int dim, bool next_attr)
+{
+	int func = get_file_geom_func(dim);
+	int attr = get_file_geom_attr(dim);
+
+	if(next_attr) {
+		attr = attr == GEOM_BY_SIZE ? GEOM_BY_AGE : GEOM_BY_SIZE;
+	} else {
+		func = (func + 1) % NUM_GEOM_FUNCS;
+	}
+	set_file_geom(dim, func, attr);
+	update_file_boxes();
+}
+
+// lays out the whole tree with the next layout engine, moving things there gradually
+void next_layout_engine()
+{
+	set_layout_engine((LayoutEngine)((get_layout_engine() + 1) % NUM_LAYOUT_ENGINES));
+
+	begin_layout_change(root, true);
+	root->layout();
+	end_layout_change(glutGet(GLUT_ELAPSED_TIME));
+	glutPostRedisplay();
+}
+
+/* attaches whatever the background scans found so far, and lays out the tree
+ * again. Layout only goes over what changed, but a change near the top can
+ * still move most of the tree, so it's done at most every layout_interval
+ * msec, which adapts to keep it under a tenth of the time.
+ */
+void poll_scan(int val)
+{
+	unsigned int msec = glutGet(GLUT_ELAPSED_TIME);
+	bool pending = scan_pending();
+
+	if(msec - last_layout_time >= layout_interval || !pending) {
+		if(apply_scan_results()) {
+			cache_dirty = true;
+			update_layout();
+
+			last_layout_time = glutGet(GLUT_ELAPSED_TIME);
+			layout_interval = MAX((last_layout_time - msec) * 10, SCAN_POLL_INTERVAL);
+
+			glutPostRedisplay();
+		}
+	}
+
+	if(msec - rate_time >= 500) {
+		long count = get_scan_count();
+		scan_rate = (count - rate_count) * 1000.0 / (msec - rate_time);
+		rate_count = count;
+		rate_time = msec;
+
+		glutPostRedisplay();
+	}
+
+	if(pending) {
+		glutTimerFunc(SCAN_POLL_INTERVAL, poll_scan, 0);
+	} else {
+		polling_scan = false;
+		save_tree();
+		prefetch_id_names();
+		// the files were sized by the ranges of the tree found so far
+		update_file_boxes();
+	}
+}
+
+// applies the changes to the filesystem reported since the last poll
+void poll_watch(int val)
+{
+	if(apply_watch_events()) {
+		cache_dirty = true;
+		update_layout();
+
+		if(scan_pending()) {
+			start_polling_scan();	// new directories are being scanned
+		}
+		glutPostRedisplay();
+	}
+
+	glutTimerFunc(WATCH_POLL_INTERVAL, poll_watch, 0);
+}
+
+void node_removed(const FSNode *node)
+{
+	if(node == clicked_node) {
+		clicked_node = 0;
+	}
+	if(!stubs.empty()) {
+		stubs.erase((Dir*)node);
+	}
+}
+
+/* writes the tree to the scan cache if it changed. Not while a scan is still
+ * running, as directories already marked as read might be missing some of
+ * their entries.
+ */
+void save_tree()
+{
+	if(cache_fname && cache_dirty && !scan_pending()) {
+		if(save_cache(root, cache_fname)) {
+			cache_dirty = false;
+		}
+	}
+}
+
+// headless mode: scans the whole tree in the foreground, and writes it out
+int scan_to_snapshot()
+{
+	Dir *tree = new Dir;
+	char path[PATH_MAX];
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(!build_tree(tree, root_dirname)) {
+		return 1;
+	}
+	if(get_scan_metadata() == SCAN_META_LAZY) {
+		fill_metadata(tree);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("scanned %ld entries in %.2f sec\n", get_scan_count(),
+			(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+
+	// the snapshot may be opened elsewhere, where a relative path means nothing
+	if(realpath(root_dirname, path)) {
+		tree->set_name(path);
+	}
+	if(!write_snapshot(tree, out_fname)) {
+		return 1;
+	}
+	return 0;
+}
+
 unsigned int load_texture(const char *fname)
 {
 	void *img;
@@ -425,12 +782,97 @@ int parse_args(int argc, char **argv)
 	int i;
 
 	for(i=1; i<argc; i++) {
+		int glut_args = glut_option_args(argv[i]);
+		if(glut_args >= 0) {
+			i += glut_args;	// left for glutInit
+			continue;
+		}
+
 		if(argv[i][0] == '-' && argv[i][2] == 0) {
 			switch(argv[i][1]) {
 			case 's':
 				stereo = !stereo;
 				break;
 
+			case 'u':
+				set_scan_backend(SCAN_BACKEND_URING);
+				break;
+
+			case 'd':
+				if(!argv[++i] || !isdigit(argv[i][0])) {
+					fprintf(stderr, "-d must be followed by the scan depth\n");
+					return -1;
+				}
+				set_scan_depth(atoi(argv[i]));
+				break;
+
+			case 'l':
+				set_scan_metadata(SCAN_META_LAZY);
+				break;
+
+			case 'x':
+				set_scan_one_fs(true);
+				break;
+
+			case 'L':
+				set_scan_follow_links(true);
+				break;
+
+			case 'e':
+				if(!argv[++i]) {
+					fprintf(stderr, "-e must be followed by a pattern of names to exclude\n");
+					return -1;
+				}
+				add_scan_exclude(argv[i]);
+				break;
+
+			case 'a':
+				if(!argv[++i] || !(isdigit(argv[i][0]) || argv[i][0] == '.')) {
+					fprintf(stderr, "-a must be followed by the duration of animations in seconds\n");
+					return -1;
+				}
+				set_anim_time(atof(argv[i]));
+				break;
+
+			case 'm':
+				if(!argv[++i] || !parse_layout_engine(argv[i])) {
+					fprintf(stderr, "-m must be followed by the layout: rows, treemap or radial\n");
+					return -1;
+				}
+				break;
+
+			case 'w':
+				live = true;
+				break;
+
+			case 'c':
+				use_cache = true;
+				break;
+
+			case 'o':
+				if(!argv[++i]) {
+					fprintf(stderr, "-o must be followed by a snapshot file\n");
+					return -1;
+				}
+				snap_fname = argv[i];
+				break;
+
+			case 'S':
+				if(!argv[++i]) {
+					fprintf(stderr, "-S must be followed by the snapshot file to write\n");
+					return -1;
+				}
+				out_fname = argv[i];
+				break;
+
+			case 't':
+				if(!argv[++i] || !isdigit(argv[i][0])) {
+					fprintf(stderr, "-t must be followed by the number of scanner threads\n");
+					return -1;
+				}
+				set_scan_threads(atoi(argv[i]));
+				break;
+
 			default:
 				fprintf(stderr, "invalid option: %s\n", argv[i]);
 				return -1;
@@ -449,3 +891,35 @@ int parse_args(int argc, char **argv)
 	}
 	return 0;
 }
+
+/* returns the number of arguments of an option handled by glutInit, or -1 if
+ * it isn't one of them
+ */
+int glut_option_args(const char *opt)
+{
+	static const char *with_arg[] = {"-display", "-geometry", 0};
+	static const char *no_arg[] = {"-direct", "-indirect", "-iconic", "-gldebug", "-sync", 0};
+
+	for(int i=0; with_arg[i]; i++) {
+		if(strcmp(opt, with_arg[i]) == 0) {
+			return 1;
+		}
+	}
+	for(int i=0; no_arg[i]; i++) {
+		if(strcmp(opt, no_arg[i]) == 0) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+bool parse_layout_engine(const char *name)
+{
+	for(int i=0; i<NUM_LAYOUT_ENGINES; i++) {
+		if(strcmp(name, get_layout_engine_name((LayoutEngine)i)) == 0) {
+			set_layout_engine((LayoutEngine)i);
+			return true;
+		}
+	}
+	return false;
+}
@@ -1,24 +1,39 @@
 #include <stdio.h>
 #include <string.h>
-#include <errno.h>
 #include <float.h>
 #include <assert.h>
-#include <unistd.h>
-#include <dirent.h>
-#include <pwd.h>
-#include <grp.h>
-#include <sys/stat.h>
+#include <pthread.h>
+#include <queue>
+#include <set>
 #include "fstree.h"
+#include "arena.h"
 #include "vis.h"
 #include "text.h"
+#include "idnames.h"
+#include "treejob.h"
+#include "filegeom.h"
+#include "scan.h"
 
 using namespace std;
 
+// trees with fewer nodes are laid out by a single thread
+#define LAYOUT_GRAIN	20000
+
 static Vector2 calc_dir_size(int num_files);
+static void add_id(NodeArena *arena, uint32_t **ids, uint32_t *num, uint32_t *max, uint32_t id);
+static bool remove_id(uint32_t *ids, uint32_t *num, uint32_t id);
 
 
 static float params[NUM_LAYOUT_PARAMS];
+static LayoutEngine engine = LAYOUT_ROWS;
+static const char *engine_names[] = {"rows", "treemap", "radial"};
 static FSNode *selnode;
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<void (*)(const FSNode*)> free_funcs;
+static void (*change_func)(const FSNode*);
+// directories of the files which took over counting an inode, see File::set_stat
+static set<Dir*> relinked_dirs;
+static pthread_mutex_t relinked_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 void set_layout_param(LayoutParameter which, float val)
@@ -31,72 +46,76 @@ float get_layout_param(LayoutParameter which)
 	return params[which];
 }
 
-FSNode *get_selection()
+void set_layout_engine(LayoutEngine e)
 {
-	return selnode;
+	engine = e;
 }
 
-#ifndef PATH_MAX
-#define PATH_MAX	1024
-#endif
+LayoutEngine get_layout_engine()
+{
+	return engine;
+}
 
-bool build_tree(Dir *tree, const char *dirname)
+const char *get_layout_engine_name(LayoutEngine e)
 {
-	DIR *dir;
-	struct dirent *dent;
-	char cur_dir[PATH_MAX];
+	return engine_names[e];
+}
 
-	tree->set_name(dirname);
+FSNode *get_selection()
+{
+	return selnode;
+}
 
-	if(!(dir = opendir(dirname))) {
-		fprintf(stderr, "failed to open dir: %s: %s\n", dirname, strerror(errno));
-		return false;
-	}
+void lock_tree()
+{
+	pthread_mutex_lock(&tree_lock);
+}
 
-	getcwd(cur_dir, PATH_MAX);
-	if(chdir(dirname) == -1) {
-		fprintf(stderr, "chdir(\"%s\") failed: %s\n", dirname, strerror(errno));
-		closedir(dir);
-		return false;
-	}
+void unlock_tree()
+{
+	pthread_mutex_unlock(&tree_lock);
+}
 
-	while((dent = readdir(dir))) {
-		struct stat st;
+void add_node_free_func(void (*func)(const FSNode*))
+{
+	free_funcs.push_back(func);
+}
 
-		if(stat(dent->d_name, &st) == -1) {
-			fprintf(stderr, "%s: stat failed: %s\n", dent->d_name, strerror(errno));
-			continue;
-		}
+void set_layout_change_func(void (*func)(const FSNode*))
+{
+	change_func = func;
+}
 
-		if(st.st_mode & S_IFDIR) {
-			if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
-				continue;
-			}
+Dir *new_dir(NodeArena *arena)
+{
+	return new(arena->alloc(sizeof(Dir))) Dir(arena);
+}
 
-			Dir *node = new Dir;
-			tree->add_subdir(node);
+File *new_file(NodeArena *arena)
+{
+	return new(arena->alloc(sizeof(File))) File(arena);
+}
 
-			build_tree(node, dent->d_name);
-		} else {
-			File *file = new File;
-			file->set_name(dent->d_name);
-			file->set_size(st.st_size);
-			file->set_mode(st.st_mode);
-			file->set_uid(st.st_uid);
-			file->set_gid(st.st_gid);
-			file->set_time(ATIME, st.st_atime);
-			file->set_time(MTIME, st.st_mtime);
-			file->set_time(CTIME, st.st_ctime);
-			tree->add_file(file);
+void free_node(FSNode *node)
+{
+	NodeArena *arena = node->get_arena();
+
+	if(node->is_dir()) {
+		Dir *dir = (Dir*)node;
+		if(dir->owns_arena()) {
+			delete dir;		// the root of a tree, not from its own arena
+			return;
 		}
+		dir->~Dir();
+		arena->free(dir, sizeof(Dir));
+	} else {
+		((File*)node)->~File();
+		arena->free(node, sizeof(File));
 	}
-	closedir(dir);
-
-	chdir(cur_dir);
-	return true;
 }
 
-
+// a column of the attributes of this node, see NodePage
+#define ATTR(col)	(arena->get_page(id)->col[id & NODE_PAGE_MASK])
 
 // --- link between directories ---
 
@@ -117,26 +136,52 @@ bool Link::intersect(const Ray &ray, float *pt) const
 	return false;	// TODO implement
 }
 
-// --- abstract base class FSNode ---
+// --- base class FSNode ---
 
-FSNode::FSNode()
+FSNode::FSNode(NodeArena *arena, NodeKind kind)
 {
+	this->arena = arena;
+	this->kind = kind;
+	id = arena->alloc_id(this);
 	name = 0;
-	size = 0;
 	parent = 0;
 	selected = false;
+
+	ATTR(kind) = kind;
+	ATTR(size) = 0;
+	ATTR(inode) = 0;
+	ATTR(vis_pos) = ATTR(vis_size) = Vector3(0, 0, 0);
 }
 
 FSNode::~FSNode()
 {
-	delete [] name;
+	if(selnode == this) {
+		selnode = 0;
+	}
+	for(size_t i=0; i<free_funcs.size(); i++) {
+		free_funcs[i](this);
+	}
+	if(arena) {	// unless it was the root, which released the arena already
+		arena->free_name(name);
+		arena->free_id(id);
+	}
+}
+
+NodeArena *FSNode::get_arena() const
+{
+	return arena;
+}
+
+uint32_t FSNode::get_id() const
+{
+	return id;
 }
 
 void FSNode::set_name(const char *name)
 {
-	delete [] this->name;
-	this->name = new char[strlen(name) + 1];
-	strcpy(this->name, name);
+	const char *prev = this->name;
+	this->name = arena->alloc_name(name);
+	arena->free_name(prev);	// after, in case it's the same string
 }
 
 const char *FSNode::get_name() const
@@ -146,32 +191,40 @@ const char *FSNode::get_name() const
 
 void FSNode::set_size(size_t sz)
 {
-	size = sz;
+	ATTR(size) = sz;
 }
 
 size_t FSNode::get_size() const
 {
-	return size;
+	return ATTR(size);
 }
 
 void FSNode::set_vis_pos(const Vector3 &vpos)
 {
-	vis_pos = vpos;
+	Vector3 &cur = ATTR(vis_pos);
+	if(change_func && (vpos.x != cur.x || vpos.y != cur.y || vpos.z != cur.z)) {
+		change_func(this);
+	}
+	cur = vpos;
 }
 
 const Vector3 &FSNode::get_vis_pos() const
 {
-	return vis_pos;
+	return ATTR(vis_pos);
 }
 
 void FSNode::set_vis_size(const Vector3 &vsize)
 {
-	vis_size = vsize;
+	Vector3 &cur = ATTR(vis_size);
+	if(change_func && (vsize.x != cur.x || vsize.y != cur.y || vsize.z != cur.z)) {
+		change_func(this);
+	}
+	cur = vsize;
 }
 
 const Vector3 &FSNode::get_vis_size() const
 {
-	return vis_size;
+	return ATTR(vis_size);
 }
 
 void FSNode::set_parent(FSNode *p)
@@ -184,6 +237,20 @@ const FSNode *FSNode::get_parent() const
 	return parent;
 }
 
+Vector3 FSNode::get_text_pos() const
+{
+	if(kind == KIND_DIR) {
+		float zoffs = get_vis_size().z / 2.0 + get_line_advance() * get_text_size();
+		return get_vis_pos() + Vector3(0, 0, zoffs);
+	}
+	return get_vis_pos() + Vector3(0, get_vis_size().y, 0);
+}
+
+float FSNode::get_text_size() const
+{
+	return kind == KIND_DIR ? 5.0 : 1.0;
+}
+
 void FSNode::draw() const
 {
 	draw_node(this);
@@ -200,6 +267,7 @@ enum {
 
 bool FSNode::intersect(const Ray &ray, float *pt) const
 {
+	const Vector3 &vis_pos = get_vis_pos(), &vis_size = get_vis_size();
 	Vector3 min = vis_pos - vis_size, max = vis_pos + vis_size;
 
 	static const Vector3 pnorm[] = {
@@ -257,205 +325,666 @@ bool FSNode::intersect(const Ray &ray, float *pt) const
 
 // --- File class ---
 
-File::File()
+File::File(NodeArena *arena)
+	: FSNode(arena, KIND_FILE)
+{
+	ATTR(nlink) = 0;
+	ATTR(mode) = 0;
+	ATTR(uid) = ATTR(gid) = 0;
+	ATTR(time[ATIME]) = ATTR(time[MTIME]) = ATTR(time[CTIME]) = 0;
+	stat_valid = false;
+	dup_link = false;
+	stat_failed = false;
+}
+
+File::~File()
+{
+	if(ATTR(inode) && !arena->is_releasing()) {
+		release_inode();
+	}
+}
+
+void File::set_stat(const struct stat *st)
+{
+	ATTR(size) = st->st_size;
+	ATTR(mode) = st->st_mode;
+	ATTR(uid) = st->st_uid;
+	ATTR(gid) = st->st_gid;
+	ATTR(time[ATIME]) = st->st_atime;
+	ATTR(time[MTIME]) = st->st_mtime;
+	ATTR(time[CTIME]) = st->st_ctime;
+	ATTR(nlink) = st->st_nlink;
+	note_ids(st->st_uid, st->st_gid);
+
+	InodeSet *inodes = arena->get_inodes();
+	uint64_t key = st->st_nlink > 1 ? inodes->make_key(st->st_dev, st->st_ino) : 0;
+	uint64_t prev = ATTR(inode);
+	if(key != prev) {
+		if(prev) {
+			release_inode();
+		}
+		ATTR(inode) = key;
+		dup_link = key && inodes->insert(key, id, true) != id;
+	}
+
+	// the background metadata pass may race with readers in the render loop
+	__sync_synchronize();
+	stat_valid = true;
+	stat_failed = false;
+}
+
+/* gives up the inode of the file: a duplicate link just drops out of the
+ * links to it, the one counting it hands it over to one of those, if any are
+ * left. The lock keeps the heir from being freed while it takes over, by
+ * another scanner thread, which might otherwise find itself made the owner
+ * too late to pass it on in turn.
+ */
+void File::release_inode()
+{
+	InodeSet *inodes = arena->get_inodes();
+	uint32_t heir;
+
+	pthread_mutex_lock(&relinked_lock);
+	if((!dup_link || !inodes->remove_link(ATTR(inode), id)) &&
+			inodes->remove(ATTR(inode), id, &heir)) {
+		File *file = (File*)arena->get_node(heir);
+		file->dup_link = false;
+
+		Dir *dir = (Dir*)file->get_parent();
+		if(dir) {
+			relinked_dirs.insert(dir);
+		}
+	}
+	pthread_mutex_unlock(&relinked_lock);
+}
+
+bool File::have_stat() const
+{
+	return stat_valid;
+}
+
+void File::set_stat_failed(bool failed)
+{
+	stat_failed = failed;
+}
+
+bool File::is_stat_failed() const
 {
-	num_links = 0;
-	mode = 0;
-	uid = gid = 0;
-	time[0] = time[1] = time[2] = 0;
+	return stat_failed;
 }
 
-File::~File() {}
+void File::set_dup_link(bool dup)
+{
+	dup_link = dup;
+}
+
+bool File::is_dup_link() const
+{
+	return dup_link;
+}
 
 void File::set_links(int nlinks)
 {
-	num_links = nlinks;
+	ATTR(nlink) = nlinks;
 }
 
 int File::get_links() const
 {
-	return num_links;
+	return ATTR(nlink);
 }
 
 void File::set_mode(int mode)
 {
-	this->mode = mode;
+	ATTR(mode) = mode;
 }
 
 int File::get_mode() const
 {
-	return mode;
+	return ATTR(mode);
 }
 
 void File::set_uid(int uid)
 {
-	this->uid = uid;
+	ATTR(uid) = uid;
 }
 
 int File::get_uid() const
 {
-	return uid;
+	return ATTR(uid);
 }
 
 const char *File::get_user() const
 {
-	struct passwd *pw = getpwuid(uid);
-	if(pw) {
-		return pw->pw_name;
-	}
-	return "unknown";
+	return get_user_name(get_uid());
 }
 
 void File::set_gid(int gid)
 {
-	this->gid = gid;
+	ATTR(gid) = gid;
 }
 
 int File::get_gid() const
 {
-	return gid;
+	return ATTR(gid);
 }
 
 const char *File::get_group() const
 {
-	struct group *gr = getgrgid(gid);
-	if(gr) {
-		return gr->gr_name;
-	}
-	return "unknown";
+	return get_group_name(get_gid());
 }
 
 void File::set_time(int which, time_t t)
 {
-	time[which] = t;
+	ATTR(time[which]) = t;
 }
 
 time_t File::get_time(int which) const
 {
-	return time[which];
+	return ATTR(time[which]);
 }
 
-Vector3 File::get_text_pos() const
+// --- directories ---
+
+Dir::Dir(NodeArena *arena)
+	: FSNode(arena ? arena : new NodeArena, KIND_DIR)
 {
-	return vis_pos + Vector3(0, vis_size.y, 0);
+	own_arena = !arena;
+	subdir_ids = file_ids = 0;
+	num_subdirs = num_files = 0;
+	max_subdirs = max_files = 0;
+	tot_files = tot_dirs = 0;
+	newest = 0;
+	largest = 0;
+	expanded = true;
+	skipped = false;
+	mtime = 0;
+	min_x = 1.0;
+	max_x = -1.0;	// not calculated yet
+	layout_dirty = true;
+	child_dirty = false;
 }
 
-float File::get_text_size() const
+Dir::~Dir()
 {
-	return 1.0;
-}
+	if(own_arena) {
+		arena->begin_release();	// it all goes at once below
+	} else if(ATTR(inode)) {
+		arena->get_inodes()->remove(ATTR(inode), id);
+	}
 
-// --- directories ---
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		free_node(get_subdir(i));
+	}
+	for(uint32_t i=0; i<num_files; i++) {
+		free_node(get_file(i));
+	}
+	arena->free(subdir_ids, max_subdirs * sizeof *subdir_ids);
+	arena->free(file_ids, max_files * sizeof *file_ids);
+
+	// a file under it may have taken over an inode just now
+	pthread_mutex_lock(&relinked_lock);
+	relinked_dirs.erase(this);
+	pthread_mutex_unlock(&relinked_lock);
+
+	if(own_arena) {
+		arena->free_name(name);
+		name = 0;
+		delete arena;
+		arena = 0;
+	}
+}
 
-Dir::Dir()
+bool Dir::owns_arena() const
 {
+	return own_arena;
 }
 
-Dir::~Dir() {}
-
 void Dir::add_subdir(Dir *dir)
 {
-	subdirs.push_back(dir);
+	add_id(arena, &subdir_ids, &num_subdirs, &max_subdirs, dir->get_id());
 	dir->set_parent(this);
-
-	Link link(this, dir);
-	links.push_back(link);
+	mark_layout_dirty();
 }
 
 void Dir::add_file(File *file)
 {
-	files.push_back(file);
+	add_id(arena, &file_ids, &num_files, &max_files, file->get_id());
 	file->set_parent(this);
+	mark_layout_dirty();
+}
+
+void Dir::remove_subdir(Dir *dir)
+{
+	if(remove_id(subdir_ids, &num_subdirs, dir->get_id())) {
+		dir->set_parent(0);
+		mark_layout_dirty();
+	}
+}
+
+void Dir::remove_file(File *file)
+{
+	if(remove_id(file_ids, &num_files, file->get_id())) {
+		file->set_parent(0);
+		mark_layout_dirty();
+	}
+}
+
+Dir *Dir::find_subdir(const char *name) const
+{
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		Dir *dir = get_subdir(i);
+		if(strcmp(dir->get_name(), name) == 0) {
+			return dir;
+		}
+	}
+	return 0;
+}
+
+File *Dir::find_file(const char *name) const
+{
+	for(uint32_t i=0; i<num_files; i++) {
+		File *file = get_file(i);
+		if(strcmp(file->get_name(), name) == 0) {
+			return file;
+		}
+	}
+	return 0;
+}
+
+void Dir::set_expanded(bool exp)
+{
+	expanded = exp;
 }
 
-Dir *Dir::get_subdirs() const
+bool Dir::is_expanded() const
 {
-	return subdirs.empty() ? 0 : (Dir*)&subdirs[0];
+	return expanded;
+}
+
+void Dir::set_skipped(bool skip)
+{
+	skipped = skip;
+}
+
+bool Dir::is_skipped() const
+{
+	return skipped;
+}
+
+void Dir::set_mtime(long long t)
+{
+	mtime = t;
+}
+
+long long Dir::get_mtime() const
+{
+	return mtime;
+}
+
+bool Dir::claim_inode(dev_t dev, ino_t ino)
+{
+	InodeSet *inodes = arena->get_inodes();
+	uint64_t key = inodes->make_key(dev, ino);
+
+	if(key != ATTR(inode)) {
+		if(ATTR(inode)) {
+			inodes->remove(ATTR(inode), id);
+			ATTR(inode) = 0;
+		}
+		if(key && inodes->insert(key, id) != id) {
+			return false;
+		}
+		ATTR(inode) = key;
+	}
+	return true;
+}
+
+bool Dir::calc_stats()
+{
+	if(!expanded) {
+		return false;
+	}
+
+	DirStats st;
+	st.size = 0;
+	st.num_files = num_files;
+	st.num_dirs = num_subdirs;
+	st.newest = 0;
+	st.largest = 0;
+
+	for(uint32_t i=0; i<num_files; i++) {
+		File *file = get_file(i);
+		size_t sz = file->is_dup_link() ? 0 : file->get_size();
+		time_t t = file->get_time(MTIME);
+
+		st.size += sz;
+		if(sz > st.largest) st.largest = sz;
+		if(t > st.newest) st.newest = t;
+	}
+
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		Dir *sub = get_subdir(i);
+
+		st.size += sub->get_size();
+		st.num_files += sub->tot_files;
+		st.num_dirs += sub->tot_dirs;
+		if(sub->largest > st.largest) st.largest = sub->largest;
+		if(sub->newest > st.newest) st.newest = sub->newest;
+	}
+
+	if(st.size == get_size() && st.num_files == tot_files && st.num_dirs == tot_dirs &&
+			st.newest == newest && st.largest == largest) {
+		return false;
+	}
+	set_stats(st);
+	return true;
+}
+
+void Dir::set_stats(const DirStats &st)
+{
+	set_size(st.size);
+	tot_files = st.num_files;
+	tot_dirs = st.num_dirs;
+	newest = st.newest;
+	largest = st.largest;
+}
+
+DirStats Dir::get_stats() const
+{
+	DirStats st;
+	st.size = get_size();
+	st.num_files = tot_files;
+	st.num_dirs = tot_dirs;
+	st.newest = newest;
+	st.largest = largest;
+	return st;
+}
+
+Dir *Dir::get_subdir(int idx) const
+{
+	return (Dir*)arena->get_node(subdir_ids[idx]);
 }
 
 int Dir::get_num_subdirs() const
 {
-	return (int)subdirs.size();
+	return (int)num_subdirs;
 }
 
-File *Dir::get_files() const
+const uint32_t *Dir::get_subdir_ids() const
 {
-	return files.empty() ? 0 : (File*)&files[0];
+	return subdir_ids;
 }
 
-int Dir::get_num_files() const
+File *Dir::get_file(int idx) const
 {
-	return (int)files.size();
+	return (File*)arena->get_node(file_ids[idx]);
 }
 
-Link *Dir::get_links() const
+int Dir::get_num_files() const
 {
-	return links.empty() ? 0 : (Link*)&links[0];
+	return (int)num_files;
 }
 
-int Dir::get_num_links() const
+const uint32_t *Dir::get_file_ids() const
 {
-	return (int)links.size();
+	return file_ids;
 }
 
+/* Small trees are left to a single thread, going by the aggregates (which
+ * the scans keep up to date) for the size, and so is any layout being
+ * recorded for an animation.
+ */
 void Dir::layout()
 {
-	calc_bounds();
-	place(Vector3(0, params[LP_DIR_HEIGHT] / 2.0, 0));
+	int nthreads = get_scan_threads();
+	DirStats st = get_stats();
+	if(st.num_files + st.num_dirs < LAYOUT_GRAIN || change_func) {
+		nthreads = 1;
+	}
+
+	switch(engine) {
+	case LAYOUT_TREEMAP:
+		layout_treemap(nthreads);
+		clear_layout_dirty();
+		break;
+
+	case LAYOUT_RADIAL:
+		layout_radial(nthreads);
+		clear_layout_dirty();
+		break;
+
+	default:
+		layout_rows(nthreads);
+	}
+}
+
+/* The bounds are calculated bottom-up and the positions top-down, and both
+ * only need the directory and its immediate subdirectories, so the subtrees
+ * a few levels down can be done in parallel, with the levels above them done
+ * before or after.
+ */
+void Dir::layout_rows(int nthreads)
+{
+	vector<Dir*> upper, subtrees;
+	split_tree(this, nthreads, &upper, &subtrees);
+
+	run_subtrees(subtrees, calc_subtree_bounds, nthreads);
+	for(size_t i=upper.size(); i>0; i--) {
+		upper[i - 1]->update_bounds();
+	}
+
+	set_vis_pos(Vector3(0, params[LP_DIR_HEIGHT] / 2.0, 0));
+	for(size_t i=0; i<upper.size(); i++) {
+		upper[i]->place_contents(upper[i]->get_vis_pos());
+	}
+	run_subtrees(subtrees, place_subtree, nthreads);
+}
+
+void Dir::calc_subtree_bounds(Dir *dir)
+{
+	dir->calc_bounds();
+}
+
+void Dir::place_subtree(Dir *dir)
+{
+	dir->place(dir->get_vis_pos());
+}
+
+/* Only the directories marked as changed, and the paths down to them, have
+ * their bounds calculated again. Then going down from the root again, only
+ * the subtrees which moved as a result, or have changes of their own, are
+ * placed again. Everything else is where it would be after a full layout.
+ */
+void Dir::relayout()
+{
+	Dir *root = this;
+	while(root->parent) {
+		root = (Dir*)root->parent;
+	}
+
+	if(engine != LAYOUT_ROWS) {
+		if(root->layout_dirty || root->child_dirty) {
+			root->layout();
+		}
+		return;
+	}
+	if(root->min_x > root->max_x) {
+		root->layout();		// never laid out
+		return;
+	}
+	if(root->layout_dirty || root->child_dirty) {
+		root->update_subtree_bounds();
+		root->update_place(root->get_vis_pos());
+	}
+}
+
+/* Directories are created marked, and a new subtree only needs to mark the
+ * directory it's added to. So a directory which is marked already doesn't go
+ * up again, which also keeps the scanner threads, filling in directories not
+ * yet attached to the tree, off the parents and their flags.
+ */
+void Dir::mark_layout_dirty()
+{
+	if(layout_dirty) {
+		return;
+	}
+	layout_dirty = true;
+
+	Dir *dir = (Dir*)parent;
+	while(dir && !dir->layout_dirty && !dir->child_dirty) {
+		dir->child_dirty = true;
+		dir = (Dir*)dir->parent;
+	}
+}
+
+void Dir::update_subtree_bounds()
+{
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		Dir *sub = get_subdir(i);
+		if(sub->layout_dirty || sub->child_dirty) {
+			sub->update_subtree_bounds();
+		}
+	}
+	update_bounds();
+}
+
+/* a subtree which moved is placed again as a whole, one which stayed where
+ * it was is only gone into for its changes
+ */
+void Dir::update_place(const Vector3 &pos)
+{
+	const Vector3 &cur = get_vis_pos();
+	if(pos.x != cur.x || pos.y != cur.y || pos.z != cur.z) {
+		place(pos);
+		return;
+	}
+	if(!layout_dirty && !child_dirty) {
+		return;
+	}
+
+	place_subdirs(pos, true);
+	if(layout_dirty) {
+		place_files();
+	}
+	layout_dirty = child_dirty = false;
 }
 
 void Dir::calc_bounds()
 {
-	Vector2 dir_size = calc_dir_size(files.size());
-	vis_size = Vector3(dir_size.x, params[LP_DIR_HEIGHT], dir_size.y);
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		get_subdir(i)->calc_bounds();
+	}
+	update_bounds();
+}
+
+// calculates the bounds from those of the subdirectories, returns true if they changed
+bool Dir::update_bounds()
+{
+	set_box_size();
+	float dir_width = get_vis_size().x;
 
 	float child_width = 0.0;
-	for(size_t i=0; i<subdirs.size(); i++) {
-		subdirs[i]->calc_bounds();
-		child_width += subdirs[i]->max_x - subdirs[i]->min_x;
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		Dir *sub = get_subdir(i);
+		if(sub->min_x > sub->max_x) {
+			sub->calc_bounds();	// new directory
+		}
+		child_width += sub->max_x - sub->min_x;
 	}
 
-	float width = MAX(dir_size.x, child_width);
+	float width = MAX(dir_width, child_width);
 
+	float prev_min = min_x, prev_max = max_x;
 	min_x = -(width + params[LP_DIR_SPACING]) / 2.0;
 	max_x = (width + params[LP_DIR_SPACING]) / 2.0;
+
+	return min_x != prev_min || max_x != prev_max;
+}
+
+// the box of the directory itself, big enough for the grid of its files
+void Dir::set_box_size()
+{
+	Vector2 dir_size = calc_dir_size(num_files);
+	set_vis_size(Vector3(dir_size.x, params[LP_DIR_HEIGHT], dir_size.y));
+}
+
+// for the engines which don't keep track of the changes themselves
+void Dir::clear_layout_dirty()
+{
+	layout_dirty = child_dirty = false;
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		get_subdir(i)->clear_layout_dirty();
+	}
 }
 
 void Dir::place(const Vector3 &pos)
 {
-	Vector3 child_pos;
+	place_contents(pos);
 
-	vis_pos = pos;
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		Dir *sub = get_subdir(i);
+		sub->place(sub->get_vis_pos());
+	}
+}
+
+// positions the directory and its files, and only moves the subdirectories
+void Dir::place_contents(const Vector3 &pos)
+{
+	set_vis_pos(pos);
+	place_subdirs(pos, false);
+	place_files();
+	layout_dirty = child_dirty = false;
+}
+
+/* moves each subdirectory to where it goes under this directory at pos, or
+ * with update, lets it place itself again if that's not where it was
+ */
+void Dir::place_subdirs(const Vector3 &pos, bool update)
+{
+	Vector3 child_pos;
+	const Vector3 &vis_size = get_vis_size();
 
 	float x = min_x - params[LP_DIR_SPACING] / 2.0;
-	for(size_t i=0; i<subdirs.size(); i++) {
-		float width = subdirs[i]->max_x - subdirs[i]->min_x;
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		Dir *sub = get_subdir(i);
+		float width = sub->max_x - sub->min_x;
 
 		child_pos.x = pos.x + x + width / 2.0;
 		child_pos.y = pos.y;
 		child_pos.z = pos.z - (vis_size.z / 2.0 + params[LP_DIR_DIST]);
 
-		subdirs[i]->place(child_pos);
+		if(update) {
+			sub->update_place(child_pos);
+		} else {
+			sub->set_vis_pos(child_pos);
+		}
 
 		x += width + params[LP_DIR_SPACING];
 	}
+}
+
+void Dir::place_files()
+{
+	const Vector3 &pos = get_vis_pos();
+	const Vector3 &vis_size = get_vis_size();
 
-	// -- place files --
-	int num_files = files.size();
 	int side_files = (int)ceil(sqrt(num_files));
 	float fsize = params[LP_FILE_SIZE];
 	float fspace = params[LP_FILE_SPACING];
-	float fheight = params[LP_FILE_HEIGHT];
 
 	float frow_width = side_files * fsize + (side_files - 1) * fspace;
 
 	float offs = fsize / 2.0 + fspace;
-	Vector3 fstart = vis_pos - vis_size / 2.0 + Vector3(offs, vis_size.y + fheight / 2.0, offs);
+	Vector3 fstart = pos - vis_size / 2.0 + Vector3(offs, vis_size.y, offs);
 	Vector3 fpos = fstart;
 
-	for(size_t i=0; i<files.size(); i++) {
-		files[i]->set_vis_pos(fpos);
-		files[i]->set_vis_size(Vector3(fsize, fheight, fsize));
+	for(uint32_t i=0; i<num_files; i++) {
+		File *file = get_file(i);
+		float fheight, ffoot;
+		calc_file_geom(file, &fheight, &ffoot);
+
+		file->set_vis_pos(Vector3(fpos.x, fstart.y + fheight * 0.5f, fpos.z));
+		file->set_vis_size(Vector3(ffoot, fheight, ffoot));
 
 		fpos.x += fsize + fspace;
 		if(fpos.x - fstart.x > frow_width) {
@@ -463,7 +992,6 @@ void Dir::place(const Vector3 &pos)
 			fpos.z += fsize + fspace;
 		}
 	}
-
 }
 
 /* the post-order drawing is a nice trick to avoid deferring and sorting
@@ -472,34 +1000,25 @@ void Dir::place(const Vector3 &pos)
  */
 void Dir::draw() const
 {
-	assert(links.size() == subdirs.size());
-	for(size_t i=0; i<subdirs.size(); i++) {
-		subdirs[i]->draw();
-		links[i].draw();
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		Dir *sub = get_subdir(i);
+		sub->draw();
+
+		Link link(const_cast<Dir*>(this), sub);
+		link.draw();
 	}
 	
-	for(size_t i=0; i<files.size(); i++) {
-		files[i]->draw();
+	for(uint32_t i=0; i<num_files; i++) {
+		get_file(i)->draw();
 	}
 	draw_node(this);
 
-	for(size_t i=0; i<files.size(); i++) {
-		draw_node_text(files[i]);
+	for(uint32_t i=0; i<num_files; i++) {
+		draw_node_text(get_file(i));
 	}
 	draw_node_text(this);
 }
 
-Vector3 Dir::get_text_pos() const
-{
-	float zoffs = vis_size.z / 2.0 + get_line_advance() * get_text_size();
-	return vis_pos + Vector3(0, 0, zoffs);
-}
-
-float Dir::get_text_size() const
-{
-	return 5.0;
-}
-
 FSNode *Dir::find_intersection(const Ray &ray, float *pt)
 {
 	float nearest_t = FLT_MAX;
@@ -511,17 +1030,18 @@ FSNode *Dir::find_intersection(const Ray &ray, float *pt)
 		nearest_node = this;
 	}
 
-	for(size_t i=0; i<subdirs.size(); i++) {
-		FSNode *node = subdirs[i]->find_intersection(ray, &t);
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		FSNode *node = get_subdir(i)->find_intersection(ray, &t);
 		if(node && t < nearest_t) {
 			nearest_node = node;
 			nearest_t = t;
 		}
 	}
 
-	for(size_t i=0; i<files.size(); i++) {
-		if(files[i]->intersect(ray, &t) && t < nearest_t) {
-			nearest_node = files[i];
+	for(uint32_t i=0; i<num_files; i++) {
+		File *file = get_file(i);
+		if(file->intersect(ray, &t) && t < nearest_t) {
+			nearest_node = file;
 			nearest_t = t;
 		}
 	}
@@ -551,6 +1071,49 @@ bool Dir::pick(const Ray &ray)
 	return chng;
 }
 
+/* Each directory is done after all of the changed ones below it, by taking
+ * them deepest first. The parent of any directory whose aggregates changed
+ * is queued in turn, and the same directory may be queued more than once,
+ * but then the copies come out one after the other.
+ */
+void update_stats(const vector<Dir*> &dirs)
+{
+	priority_queue<pair<int, Dir*> > queue;
+
+	for(size_t i=0; i<dirs.size(); i++) {
+		int depth = 0;
+		const FSNode *node = dirs[i];
+		while((node = node->get_parent())) {
+			depth++;
+		}
+		queue.push(make_pair(depth, dirs[i]));
+	}
+
+	Dir *prev = 0;
+	while(!queue.empty()) {
+		int depth = queue.top().first;
+		Dir *dir = queue.top().second;
+		queue.pop();
+
+		if(dir == prev) {
+			continue;
+		}
+		prev = dir;
+
+		if(dir->calc_stats() && dir->get_parent()) {
+			queue.push(make_pair(depth - 1, (Dir*)dir->get_parent()));
+		}
+	}
+}
+
+void take_relinked_dirs(vector<Dir*> *dirs)
+{
+	pthread_mutex_lock(&relinked_lock);
+	dirs->insert(dirs->end(), relinked_dirs.begin(), relinked_dirs.end());
+	relinked_dirs.clear();
+	pthread_mutex_unlock(&relinked_lock);
+}
+
 static Vector2 calc_dir_size(int num_files)
 {
 	int files_x = (int)ceil(sqrt((float)num_files));
@@ -563,3 +1126,33 @@ static Vector2 calc_dir_size(int num_files)
 	return Vector2(MAX(xsz, min_dir_sz), MAX(ysz, min_dir_sz));
 }
 
+
+/* appends an id to a child array, doubling it when it's full. Readers on
+ * other threads hold the tree lock, so the old array can go right away.
+ */
+static void add_id(NodeArena *arena, uint32_t **ids, uint32_t *num, uint32_t *max, uint32_t id)
+{
+	if(*num >= *max) {
+		uint32_t new_max = *max ? *max * 2 : 4;
+		uint32_t *new_ids = (uint32_t*)arena->alloc(new_max * sizeof *new_ids);
+		if(*num) {
+			memcpy(new_ids, *ids, *num * sizeof *new_ids);
+		}
+		arena->free(*ids, *max * sizeof **ids);
+		*ids = new_ids;
+		*max = new_max;
+	}
+	(*ids)[(*num)++] = id;
+}
+
+static bool remove_id(uint32_t *ids, uint32_t *num, uint32_t id)
+{
+	for(uint32_t i=0; i<*num; i++) {
+		if(ids[i] == id) {
+			memmove(ids + i, ids + i + 1, (*num - i - 1) * sizeof *ids);
+			(*num)--;
+			return true;
+		}
+	}
+	return false;
+}
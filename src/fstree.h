@@ -2,16 +2,21 @@
 #define FSTREE_H_
 
 #include <time.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include <vector>
 #include <vmath.h>
 
 class Dir;
+class File;
 class FSNode;
+class NodeArena;
 
 enum LayoutParameter {
 	LP_FILE_SIZE,
 	LP_FILE_SPACING,
 	LP_FILE_HEIGHT,
+	LP_FILE_MAX_HEIGHT,	// added to the height of the largest files, see filegeom.h
 
 	LP_DIR_SIZE,
 	LP_DIR_SPACING,
@@ -24,11 +29,76 @@ enum LayoutParameter {
 void set_layout_param(LayoutParameter param, float val);
 float get_layout_param(LayoutParameter param);
 
+/* How Dir::layout arranges the tree. All of them only set the positions and
+ * sizes of the nodes, which is all that drawing and picking go by.
+ */
+enum LayoutEngine {
+	LAYOUT_ROWS,	// subdirectories in a row behind their parent, files on top
+	LAYOUT_TREEMAP,	// squarified treemap: nested boxes, with areas by size
+	LAYOUT_RADIAL,	// directories on rings around the root, files on top
+
+	NUM_LAYOUT_ENGINES
+};
+
+void set_layout_engine(LayoutEngine engine);
+LayoutEngine get_layout_engine();
+const char *get_layout_engine_name(LayoutEngine engine);
+
 FSNode *get_selection();
 
-// scans the filesystem, builds the tree
+// scans the filesystem, builds the tree (in parallel, see scan.cc)
 bool build_tree(Dir *tree, const char *dirname);
 
+/* Only the thread which owns the tree (the one drawing it) may change its
+ * structure, and it must hold the tree lock while doing so. Other threads
+ * which need to walk the tree take the lock while reading child lists.
+ */
+void lock_tree();
+void unlock_tree();
+
+/* registers a function to be called for every node just before it's freed,
+ * so that other modules can drop their references to it
+ */
+void add_node_free_func(void (*func)(const FSNode*));
+
+/* while set, the layout calls func with every node whose position or size
+ * it's about to change, so that the change can be animated (see anim.h).
+ * The layout runs on a single thread in the meantime.
+ */
+void set_layout_change_func(void (*func)(const FSNode*));
+
+/* A directory created with plain new is the root of a tree, and owns the
+ * arena all the nodes under it are allocated from (see arena.h). Nodes of
+ * the tree are created with new_dir and new_file, taking the arena of their
+ * parent, and freed with free_node. Deleting the root releases the tree.
+ */
+Dir *new_dir(NodeArena *arena);
+File *new_file(NodeArena *arena);
+// frees a node, and everything under it if it's a directory
+void free_node(FSNode *node);
+
+/* Every directory keeps aggregates of everything below it, so that they can
+ * be read in constant time. They're not updated by the changes to the tree
+ * themselves: whoever changes it passes the directories it changed to
+ * update_stats, which works its way up from them for as long as anything
+ * changes. Whole new subtrees are done with calc_tree_stats (see scan.h).
+ */
+struct DirStats {
+	size_t size;		// bytes in all the files, hard links counted once
+	int num_files, num_dirs;
+	time_t newest;		// latest mtime of any file
+	size_t largest;		// size of the largest file
+};
+
+void update_stats(const std::vector<Dir*> &dirs);
+
+/* appends the directories where a file became the one counting its inode
+ * since the last call (see File::set_stat), and forgets them. Whoever frees
+ * nodes or stats files passes them on to update_stats, along with the rest of
+ * what it changed.
+ */
+void take_relinked_dirs(std::vector<Dir*> *dirs);
+
 class Link {
 public:
 	Dir *from, *to;
@@ -41,20 +111,36 @@ public:
 };
 
 
+enum NodeKind { KIND_FILE, KIND_DIR };
+
+/* The attributes of a node (size, metadata, layout) live in the columns of
+ * its arena, in the row given by its id. The accessors below are views into
+ * them.
+ *
+ * There are no virtual functions: the kind of a node is a tag, and the few
+ * things which differ between files and directories switch on it. Walking
+ * millions of nodes per frame then costs no indirect calls, and no RTTI.
+ */
 class FSNode {
 protected:
-	char *name;
-	size_t size;
-
-	Vector3 vis_pos, vis_size;
+	NodeArena *arena;
+	uint32_t id;
+	unsigned char kind;
+	const char *name;	// interned in the arena, shared with other nodes
 
 	FSNode *parent;
 
 public:
 	bool selected;
 
-	FSNode();
-	virtual ~FSNode();
+	FSNode(NodeArena *arena, NodeKind kind);
+	~FSNode();
+
+	NodeArena *get_arena() const;
+	uint32_t get_id() const;
+
+	NodeKind get_kind() const { return (NodeKind)kind; }
+	bool is_dir() const { return kind == KIND_DIR; }
 
 	void set_name(const char *name);
 	const char *get_name() const;
@@ -71,24 +157,48 @@ public:
 	void set_parent(FSNode *p);
 	const FSNode *get_parent() const;
 
-	virtual Vector3 get_text_pos() const = 0;
-	virtual float get_text_size() const = 0;
+	Vector3 get_text_pos() const;
+	float get_text_size() const;
 
-	virtual void draw() const;
-	virtual bool intersect(const Ray &ray, float *pt) const;
+	void draw() const;
+	bool intersect(const Ray &ray, float *pt) const;
 };
 
 enum { ATIME, MTIME, CTIME };
 
 class File : public FSNode {
 protected:
-	int num_links;
-	int mode, uid, gid;
-	time_t time[3];
+	volatile bool stat_valid;
+	bool dup_link;
+	bool stat_failed;
+
+	void release_inode();
 
 public:
-	File();
-	virtual ~File();
+	File(NodeArena *arena);
+	~File();
+
+	/* sets all the metadata at once from a stat buffer, and marks it valid.
+	 * Files created by a lazy scan only have the file type in their mode until
+	 * this is called.
+	 *
+	 * Files with more than one link are looked up by inode in the tree. The
+	 * first one found counts the inode, the rest are marked as duplicate
+	 * links, which take no space in the aggregates. If the one which counts
+	 * it goes away, or turns out to be another file, one of the rest takes
+	 * over, and its directory is left for take_relinked_dirs.
+	 */
+	void set_stat(const struct stat *st);
+	bool have_stat() const;
+
+	/* set by stat_file when it couldn't stat the file, so that it isn't tried
+	 * again every frame while it's shown. Cleared by set_stat.
+	 */
+	void set_stat_failed(bool failed);
+	bool is_stat_failed() const;
+
+	void set_dup_link(bool dup);
+	bool is_dup_link() const;
 
 	void set_links(int nlinks);
 	int get_links() const;
@@ -106,48 +216,126 @@ public:
 
 	void set_time(int which, time_t t);
 	time_t get_time(int which) const;
-
-	virtual Vector3 get_text_pos() const;
-	virtual float get_text_size() const;
 };
 
+/* The children of a directory are kept as arrays of node ids, allocated from
+ * the arena only once there are any, which keeps empty directories small.
+ */
 class Dir : public FSNode {
 protected:
-	std::vector<Dir*> subdirs;
-	std::vector<File*> files;
-	std::vector<Link> links;
+	uint32_t *subdir_ids, *file_ids;
+	uint32_t num_subdirs, num_files;
+	uint32_t max_subdirs, max_files;
+
+	// aggregates, the total size is the size of the directory itself
+	int tot_files, tot_dirs;
+	time_t newest;
+	size_t largest;
+
+	bool own_arena;
+	bool expanded;
+	bool skipped;
+	long long mtime;	// of the directory itself when it was read, in nsec
 
 	float min_x, max_x;
+	// contents changed since the last layout, here or somewhere below
+	bool layout_dirty, child_dirty;
 
 	void calc_bounds();
+	bool update_bounds();
+	void set_box_size();
 	void place(const Vector3 &pos);
+	void place_contents(const Vector3 &pos);
+	void place_subdirs(const Vector3 &pos, bool update);
+	void place_files();
+
+	void mark_layout_dirty();
+	void update_subtree_bounds();
+	void update_place(const Vector3 &pos);
+
+	void clear_layout_dirty();
+
+	// entry points for the threads of layout
+	static void calc_subtree_bounds(Dir *dir);
+	static void place_subtree(Dir *dir);
+
+	void layout_rows(int nthreads);
+	// the other layout engines, in layout.cc
+	void layout_treemap(int nthreads);
+	void layout_radial(int nthreads);
+	static void place_subtree_files(Dir *dir);
 
 	FSNode *find_intersection(const Ray &ray, float *pt);
 
 public:
-	Dir();
-	virtual ~Dir();
+	Dir(NodeArena *arena = 0);
+	~Dir();
+
+	bool owns_arena() const;
 
 	void add_subdir(Dir *dir);
 	void add_file(File* file);
 
-	Dir *get_subdirs() const;
+	// detach a child from this directory, without freeing it
+	void remove_subdir(Dir *dir);
+	void remove_file(File *file);
+
+	Dir *find_subdir(const char *name) const;
+	File *find_file(const char *name) const;
+
+	/* stub directories beyond the scan depth budget are not expanded, their
+	 * contents are unknown until they're scanned with scan_async
+	 */
+	void set_expanded(bool exp);
+	bool is_expanded() const;
+
+	/* stubs left by the scan policy instead (another filesystem, or a second
+	 * way into a directory already in the tree), which are only ever expanded
+	 * on request, never just for being near
+	 */
+	void set_skipped(bool skip);
+	bool is_skipped() const;
+
+	// used to tell if a cached tree is out of date, 0 if unknown
+	void set_mtime(long long t);
+	long long get_mtime() const;
+
+	/* records the inode of the directory, returns false if another directory
+	 * of the tree has it already: a second way into the same directory, by a
+	 * followed symlink or a bind mount, which may well be a loop
+	 */
+	bool claim_inode(dev_t dev, ino_t ino);
+
+	/* calc_stats sums up the aggregates of the children, and returns true if
+	 * they changed. Unexpanded directories keep whatever they were given with
+	 * set_stats, they have no children to go by.
+	 */
+	bool calc_stats();
+	void set_stats(const DirStats &st);
+	DirStats get_stats() const;
+
+	Dir *get_subdir(int idx) const;
 	int get_num_subdirs() const;
+	const uint32_t *get_subdir_ids() const;
 
-	File *get_files() const;
+	File *get_file(int idx) const;
 	int get_num_files() const;
-
-	Link *get_links() const;
-	int get_num_links() const;
+	const uint32_t *get_file_ids() const;
 
 	void layout();
+	/* lays out again whatever changed anywhere in the tree since the last
+	 * layout, at a cost which depends on the size of the change rather than
+	 * that of the tree. Adding and removing children marks the directories
+	 * as changed. Can be called on any directory of the tree. Only the rows
+	 * layout goes by the changes, the other engines lay out the whole tree
+	 * again if anything changed.
+	 */
+	void relayout();
+
+	// draws the whole subtree
+	void draw() const;
 
-	virtual void draw() const;
-
-	virtual Vector3 get_text_pos() const;
-	virtual float get_text_size() const;
-
-	virtual bool pick(const Ray &ray);
+	bool pick(const Ray &ray);
 };
 
 #endif	// FSTREE_H_
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <vector>
+#include "idnames.h"
+
+using namespace std;
+
+enum { ID_USER, ID_GROUP };
+
+struct PrefetchJob {
+	vector<int> uids, gids;
+};
+
+static const char *lookup(int type, int id);
+static char *resolve(int type, int id);
+static void *prefetch_thread(void *arg);
+
+// names are never freed, so they can be handed out without holding the lock
+static map<int, char*> names[2];
+static pthread_mutex_t names_lock = PTHREAD_MUTEX_INITIALIZER;
+// every id ever noted, and the ones not handed to a prefetch thread yet
+static set<int> noted[2];
+static vector<int> pending[2];
+
+
+const char *get_user_name(int uid)
+{
+	return lookup(ID_USER, uid);
+}
+
+const char *get_group_name(int gid)
+{
+	return lookup(ID_GROUP, gid);
+}
+
+void note_ids(int uid, int gid)
+{
+	static __thread int last_uid = -1, last_gid = -1;
+	if(uid == last_uid && gid == last_gid) {
+		return;
+	}
+	last_uid = uid;
+	last_gid = gid;
+
+	pthread_mutex_lock(&names_lock);
+	if(noted[ID_USER].insert(uid).second) {
+		pending[ID_USER].push_back(uid);
+	}
+	if(noted[ID_GROUP].insert(gid).second) {
+		pending[ID_GROUP].push_back(gid);
+	}
+	pthread_mutex_unlock(&names_lock);
+}
+
+void prefetch_id_names()
+{
+	PrefetchJob *job = new PrefetchJob;
+
+	pthread_mutex_lock(&names_lock);
+	job->uids.swap(pending[ID_USER]);
+	job->gids.swap(pending[ID_GROUP]);
+	pthread_mutex_unlock(&names_lock);
+
+	if(job->uids.empty() && job->gids.empty()) {
+		delete job;
+		return;
+	}
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if(pthread_create(&thread, &attr, prefetch_thread, job) != 0) {
+		delete job;	// they'll be looked up when needed
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/* the lock isn't held while the name service is queried, so two threads may
+ * resolve the same id at once; the first one to finish wins
+ */
+static const char *lookup(int type, int id)
+{
+	pthread_mutex_lock(&names_lock);
+	map<int, char*>::const_iterator it = names[type].find(id);
+	if(it != names[type].end()) {
+		const char *name = it->second;
+		pthread_mutex_unlock(&names_lock);
+		return name;
+	}
+	pthread_mutex_unlock(&names_lock);
+
+	char *name = resolve(type, id);
+
+	pthread_mutex_lock(&names_lock);
+	pair<map<int, char*>::iterator, bool> res = names[type].insert(make_pair(id, name));
+	if(!res.second) {
+		free(name);
+		name = res.first->second;
+	}
+	pthread_mutex_unlock(&names_lock);
+	return name;
+}
+
+/* getpwuid/getgrgid return static buffers, which the prefetch thread would
+ * overwrite under the main thread, so the reentrant versions are used
+ */
+static char *resolve(int type, int id)
+{
+	struct passwd pw, *pwres = 0;
+	struct group gr, *grres = 0;
+	const char *name = 0;
+
+	size_t bufsz = 1024;
+	char *buf = 0;
+	int err;
+
+	do {
+		bufsz *= 2;
+		buf = (char*)realloc(buf, bufsz);
+		if(type == ID_USER) {
+			err = getpwuid_r(id, &pw, buf, bufsz, &pwres);
+		} else {
+			err = getgrgid_r(id, &gr, buf, bufsz, &grres);
+		}
+	} while(err == ERANGE && bufsz < 65536);
+
+	if(pwres) {
+		name = pwres->pw_name;
+	} else if(grres) {
+		name = grres->gr_name;
+	}
+
+	char *res = strdup(name ? name : "unknown");
+	free(buf);
+	return res;
+}
+
+static void *prefetch_thread(void *arg)
+{
+	PrefetchJob *job = (PrefetchJob*)arg;
+
+	for(size_t i=0; i<job->uids.size(); i++) {
+		lookup(ID_USER, job->uids[i]);
+	}
+	for(size_t i=0; i<job->gids.size(); i++) {
+		lookup(ID_GROUP, job->gids[i]);
+	}
+
+	delete job;
+	return 0;
+}
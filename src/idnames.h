@@ -0,0 +1,21 @@
+#ifndef IDNAMES_H_
+#define IDNAMES_H_
+
+/* user and group names by id, looked up once per id for the whole process.
+ * The name service may have to read /etc/passwd or ask a directory server,
+ * which is too slow for the info panel, redrawn every frame while hovering.
+ * The strings returned stay valid until the program exits.
+ */
+const char *get_user_name(int uid);
+const char *get_group_name(int gid);
+
+/* note_ids is called for every file stat'ed, by whichever thread is scanning,
+ * and remembers the ids it hasn't seen before. Each thread skips the ids of
+ * the file before, so the lock is only taken when the owner changes.
+ * prefetch_id_names resolves the ids noted since the last call in a
+ * background thread.
+ */
+void note_ids(int uid, int gid);
+void prefetch_id_names();
+
+#endif	// IDNAMES_H_
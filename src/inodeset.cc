@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include "inodeset.h"
+#include "arena.h"
+
+#define INO_BITS		48
+#define INIT_SIZE		1024
+// end of a chain of links
+#define NO_LINK			0xffffffff
+
+#define SHARD(hash)		((hash) >> 58)
+
+static uint64_t hash_key(uint64_t key);
+
+InodeSet::InodeSet(NodeArena *arena)
+{
+	this->arena = arena;
+	memset(shards, 0, sizeof shards);
+	num_devs = 0;
+	dev_lock = 0;
+}
+
+InodeSet::~InodeSet()
+{
+	for(int i=0; i<INODE_SHARDS; i++) {
+		delete [] shards[i].keys;
+		delete [] shards[i].owners;
+	}
+}
+
+uint64_t InodeSet::make_key(dev_t dev, ino_t ino)
+{
+	if(!ino || (uint64_t)ino >> INO_BITS) {
+		return 0;
+	}
+
+	int idx;
+	int count = num_devs;
+	for(idx=0; idx<count; idx++) {
+		if(devs[idx] == dev) break;
+	}
+
+	if(idx == count) {
+		spin_lock(&dev_lock);
+		// someone else may have added it in the meantime
+		for(idx=0; idx<num_devs; idx++) {
+			if(devs[idx] == dev) break;
+		}
+		if(idx == num_devs && idx < MAX_DEVS) {
+			devs[idx] = dev;
+			__sync_synchronize();
+			num_devs++;
+		}
+		__sync_lock_release(&dev_lock);
+
+		if(idx >= MAX_DEVS) {
+			return 0;
+		}
+	}
+
+	return ((uint64_t)(idx + 1) << INO_BITS) | (uint64_t)ino;
+}
+
+uint32_t InodeSet::insert(uint64_t key, uint32_t id, bool link)
+{
+	uint64_t hash = hash_key(key);
+	Shard *shard = shards + SHARD(hash);
+
+	spin_lock(&shard->lock);
+
+	if(shard->count * 4 >= shard->size * 3) {
+		grow(shard);
+	}
+
+	size_t mask = shard->size - 1;
+	size_t idx = hash & mask;
+	while(shard->keys[idx]) {
+		if(shard->keys[idx] == key) {
+			uint32_t owner = shard->owners[idx];
+			if(link && owner != id) {
+				// right after the owner
+				*next_link(id) = *next_link(owner);
+				*next_link(owner) = id;
+			}
+			__sync_lock_release(&shard->lock);
+			return owner;
+		}
+		idx = (idx + 1) & mask;
+	}
+
+	shard->keys[idx] = key;
+	shard->owners[idx] = id;
+	shard->count++;
+	*next_link(id) = NO_LINK;
+
+	__sync_lock_release(&shard->lock);
+	return id;
+}
+
+bool InodeSet::remove_link(uint64_t key, uint32_t id)
+{
+	uint64_t hash = hash_key(key);
+	Shard *shard = shards + SHARD(hash);
+	bool found = false;
+
+	spin_lock(&shard->lock);
+
+	if(shard->size) {
+		size_t mask = shard->size - 1;
+		size_t idx = hash & mask;
+		while(shard->keys[idx] && shard->keys[idx] != key) {
+			idx = (idx + 1) & mask;
+		}
+
+		if(shard->keys[idx] && shard->owners[idx] != id) {
+			uint32_t prev = shard->owners[idx];
+			uint32_t next;
+			while((next = *next_link(prev)) != NO_LINK) {
+				if(next == id) {
+					*next_link(prev) = *next_link(id);
+					found = true;
+					break;
+				}
+				prev = next;
+			}
+		}
+	}
+
+	__sync_lock_release(&shard->lock);
+	return found;
+}
+
+bool InodeSet::remove(uint64_t key, uint32_t id, uint32_t *heir)
+{
+	uint64_t hash = hash_key(key);
+	Shard *shard = shards + SHARD(hash);
+
+	spin_lock(&shard->lock);
+
+	if(!shard->size) {
+		__sync_lock_release(&shard->lock);
+		return false;
+	}
+
+	size_t mask = shard->size - 1;
+	size_t idx = hash & mask;
+	while(shard->keys[idx] && shard->keys[idx] != key) {
+		idx = (idx + 1) & mask;
+	}
+
+	if(!shard->keys[idx] || shard->owners[idx] != id) {
+		__sync_lock_release(&shard->lock);
+		return false;
+	}
+
+	// the rest of the chain goes on from the heir
+	uint32_t link = *next_link(id);
+	if(link != NO_LINK) {
+		shard->owners[idx] = link;
+		if(heir) {
+			*heir = link;
+		}
+		__sync_lock_release(&shard->lock);
+		return true;
+	}
+
+	// shift back the entries which follow, as with the names of the arena
+	size_t next = idx;
+	for(;;) {
+		next = (next + 1) & mask;
+		if(!shard->keys[next]) {
+			break;
+		}
+		size_t home = hash_key(shard->keys[next]) & mask;
+		if(((next - home) & mask) >= ((next - idx) & mask)) {
+			shard->keys[idx] = shard->keys[next];
+			shard->owners[idx] = shard->owners[next];
+			idx = next;
+		}
+	}
+	shard->keys[idx] = 0;
+	shard->count--;
+
+	__sync_lock_release(&shard->lock);
+	return false;
+}
+
+size_t InodeSet::get_count() const
+{
+	size_t count = 0;
+	for(int i=0; i<INODE_SHARDS; i++) {
+		count += shards[i].count;
+	}
+	return count;
+}
+
+size_t InodeSet::get_mem() const
+{
+	size_t mem = 0;
+	for(int i=0; i<INODE_SHARDS; i++) {
+		mem += shards[i].size * (sizeof *shards[i].keys + sizeof *shards[i].owners);
+	}
+	return mem;
+}
+
+// called with the shard locked
+void InodeSet::grow(Shard *shard)
+{
+	size_t new_size = shard->size ? shard->size * 2 : INIT_SIZE;
+	uint64_t *new_keys = new uint64_t[new_size];
+	uint32_t *new_owners = new uint32_t[new_size];
+	memset(new_keys, 0, new_size * sizeof *new_keys);
+
+	for(size_t i=0; i<shard->size; i++) {
+		if(shard->keys[i]) {
+			size_t idx = hash_key(shard->keys[i]) & (new_size - 1);
+			while(new_keys[idx]) {
+				idx = (idx + 1) & (new_size - 1);
+			}
+			new_keys[idx] = shard->keys[i];
+			new_owners[idx] = shard->owners[i];
+		}
+	}
+
+	delete [] shard->keys;
+	delete [] shard->owners;
+	shard->keys = new_keys;
+	shard->owners = new_owners;
+	shard->size = new_size;
+}
+
+// the chains of links go through the nodes, called with the shard locked
+uint32_t *InodeSet::next_link(uint32_t id) const
+{
+	return arena->get_page(id)->next_link + (id & NODE_PAGE_MASK);
+}
+
+/* inode numbers are mostly sequential, so they need a proper mix before the
+ * top bits pick the shard (the splitmix64 finalizer)
+ */
+static uint64_t hash_key(uint64_t key)
+{
+	key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+	key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+	return key ^ (key >> 31);
+}
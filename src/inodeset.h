@@ -0,0 +1,74 @@
+#ifndef INODESET_H_
+#define INODESET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define INODE_SHARDS	64
+#define MAX_DEVS		256
+
+class NodeArena;
+
+/* The inodes of the directories of a tree, and of its files with more than
+ * one link, each with the id of the node which owns it. A file reached through
+ * several hard links is only counted once, and a directory reached a second
+ * time isn't read again. Scanner threads add to it concurrently, so it's split in
+ * shards by hash, each with its own lock, and each an open addressing table
+ * of packed keys: an index into the devices seen so far in the top bits, the
+ * inode number below. That's 12 bytes per slot, with the tables between 3/8
+ * and 3/4 full, 16 to 32 bytes per inode: 20 million take under 400mb. Files
+ * with a single link, most of them outside of backup trees, don't go in.
+ *
+ * The other links to the inode of a file are kept too, so that when the owner
+ * goes away the count passes on to one of them. They're chained from the
+ * owner through the next_link column of the arena (see NodePage), which
+ * costs nothing more per link, and only the owner is in the table.
+ */
+class InodeSet {
+private:
+	struct Shard {
+		uint64_t *keys;		// 0 for empty slots
+		uint32_t *owners;
+		size_t size, count;
+		volatile int lock;
+	};
+	Shard shards[INODE_SHARDS];
+	NodeArena *arena;	// for the chains of links
+
+	// only ever appended to, readers go by num_devs
+	dev_t devs[MAX_DEVS];
+	volatile int num_devs;
+	volatile int dev_lock;
+
+	void grow(Shard *shard);
+	uint32_t *next_link(uint32_t id) const;
+
+public:
+	InodeSet(NodeArena *arena);
+	~InodeSet();
+
+	/* returns 0 if the inode can't be tracked: more devices than there's
+	 * room for, or an inode number too large to pack
+	 */
+	uint64_t make_key(dev_t dev, ino_t ino);
+
+	/* adds an inode if it's not there already, returns the id of its owner.
+	 * With link set, an id which doesn't get to own it is kept as another
+	 * link to it, until remove_link.
+	 */
+	uint32_t insert(uint64_t key, uint32_t id, bool link = false);
+	// false if id isn't a link to it, which includes having become its owner
+	bool remove_link(uint64_t key, uint32_t id);
+
+	/* removes an inode, only if it's owned by id. If there are other links to
+	 * it, the last one added becomes the owner instead: returns true, and its
+	 * id in heir.
+	 */
+	bool remove(uint64_t key, uint32_t id, uint32_t *heir = 0);
+
+	size_t get_count() const;
+	size_t get_mem() const;
+};
+
+#endif	// INODESET_H_
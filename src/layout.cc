@@ -0,0 +1,333 @@
+/* the layout engines other than the rows of Dir::layout_rows, see LayoutEngine */
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "fstree.h"
+#include "arena.h"
+#include "treejob.h"
+#include "filegeom.h"
+
+using namespace std;
+
+/* every node gets at least this fraction of the average size as its weight
+ * in the treemap, so that empty files and directories don't vanish
+ */
+#define TREEMAP_MIN_SHARE	0.1f
+// area of the whole treemap, in file cells per node
+#define TREEMAP_CELLS		4.0f
+
+struct TreemapItem {
+	float weight;
+	FSNode *node;
+};
+
+static void weigh_treemap_subtree(Dir *dir);
+static void place_treemap_subtree(Dir *dir);
+static float weigh_contents(const Dir *dir);
+static void place_treemap(Dir *dir, vector<TreemapItem> *items);
+static void place_treemap_contents(Dir *dir, vector<TreemapItem> *items);
+static void squarify(const TreemapItem *items, int count, float x, float z, float width,
+		float depth, float base);
+static void place_item(FSNode *node, float x, float z, float width, float depth, float base);
+static bool heavier(const TreemapItem &a, const TreemapItem &b);
+
+
+/* by node id: the weights of the nodes for both engines (sizes for the
+ * treemap, number of leaf directories for the radial layout), and the angle
+ * each directory's wedge starts at in the radial layout
+ */
+static vector<float> weights;
+static vector<float> angles;
+static float min_weight;
+
+
+/* Squarified treemap (Bruls, Huizing and van Wijk): every directory is a
+ * slab, with its files and subdirectories packed on top of it, with areas by
+ * size, in rows which keep them as close to square as they can be. The side
+ * of the whole thing grows with the square root of the number of nodes,
+ * instead of with the number of leaves like the rows. The weights go
+ * bottom-up, and then the areas top-down, each only needing a directory and
+ * its children, which splits up between threads like the rows layout does.
+ */
+void Dir::layout_treemap(int nthreads)
+{
+	DirStats st = get_stats();
+	float count = st.num_files + st.num_dirs + 1;
+	min_weight = st.size > 0 ? (float)st.size / count * TREEMAP_MIN_SHARE : 1.0f;
+	weights.resize(arena->get_id_limit());
+
+	vector<Dir*> upper, subtrees;
+	split_tree(this, nthreads, &upper, &subtrees);
+
+	run_subtrees(subtrees, weigh_treemap_subtree, nthreads);
+	for(size_t i=upper.size(); i>0; i--) {
+		weights[upper[i - 1]->get_id()] = weigh_contents(upper[i - 1]);
+	}
+
+	float cell = get_layout_param(LP_FILE_SIZE) + get_layout_param(LP_FILE_SPACING);
+	float side = sqrt(count * TREEMAP_CELLS) * cell;
+	float height = get_layout_param(LP_DIR_HEIGHT);
+	set_vis_pos(Vector3(0, height / 2.0, 0));
+	set_vis_size(Vector3(side, height, side));
+
+	vector<TreemapItem> items;
+	for(size_t i=0; i<upper.size(); i++) {
+		place_treemap_contents(upper[i], &items);
+	}
+	run_subtrees(subtrees, place_treemap_subtree, nthreads);
+}
+
+/* Radial layout: each directory at a distance from the root by its depth, in
+ * the middle of a wedge of the circle, with a share of it by the number of
+ * leaf directories under it, divided among its subdirectories in turn. The
+ * rings are pushed out until every wedge is wide enough for the directory in
+ * it. The directories are few next to the files, and get a pass of their own
+ * breadth-first, on one thread. The files are placed on top of each of them
+ * after, split up between threads.
+ */
+void Dir::layout_radial(int nthreads)
+{
+	vector<Dir*> dirs;
+	vector<int> depths;
+	dirs.push_back(this);
+	depths.push_back(0);
+	for(size_t i=0; i<dirs.size(); i++) {
+		for(uint32_t j=0; j<dirs[i]->num_subdirs; j++) {
+			dirs.push_back(dirs[i]->get_subdir(j));
+			depths.push_back(depths[i] + 1);
+		}
+	}
+
+	weights.resize(arena->get_id_limit());
+	angles.resize(arena->get_id_limit());
+
+	// by depth: room needed along the ring per unit of weight, and largest box
+	vector<float> need, extent;
+	float spacing = get_layout_param(LP_DIR_SPACING);
+
+	for(size_t i=dirs.size(); i>0; i--) {
+		Dir *dir = dirs[i - 1];
+		int depth = depths[i - 1];
+
+		float weight = 0;
+		for(uint32_t j=0; j<dir->num_subdirs; j++) {
+			weight += weights[dir->get_subdir(j)->get_id()];
+		}
+		if(weight <= 0) {
+			weight = 1;
+		}
+		weights[dir->get_id()] = weight;
+
+		// boxes are square to the axes, and take this much room in any direction
+		dir->set_box_size();
+		const Vector3 &size = dir->get_vis_size();
+		float box = MAX(size.x, size.z) * M_SQRT2;
+
+		if(depth >= (int)need.size()) {
+			need.resize(depth + 1, 0);
+			extent.resize(depth + 1, 0);
+		}
+		need[depth] = MAX(need[depth], (box + spacing) / weight);
+		extent[depth] = MAX(extent[depth], box);
+	}
+
+	float total = weights[get_id()];
+	vector<float> radius(need.size(), 0);
+	for(size_t i=1; i<radius.size(); i++) {
+		float dist = radius[i - 1] + (extent[i - 1] + extent[i]) / 2.0 + get_layout_param(LP_DIR_DIST);
+		float arc = need[i] * total / (2.0 * M_PI);
+		radius[i] = MAX(dist, arc);
+	}
+
+	float y = get_layout_param(LP_DIR_HEIGHT) / 2.0;
+	angles[get_id()] = 0;
+
+	for(size_t i=0; i<dirs.size(); i++) {
+		Dir *dir = dirs[i];
+		float r = radius[depths[i]];
+		float start = angles[dir->get_id()];
+		float mid = start + M_PI * weights[dir->get_id()] / total;
+		dir->set_vis_pos(Vector3(r * cos(mid), y, r * sin(mid)));
+
+		for(uint32_t j=0; j<dir->num_subdirs; j++) {
+			uint32_t sub_id = dir->get_subdir(j)->get_id();
+			angles[sub_id] = start;
+			start += 2.0 * M_PI * weights[sub_id] / total;
+		}
+	}
+
+	vector<Dir*> upper, subtrees;
+	split_tree(this, nthreads, &upper, &subtrees);
+	for(size_t i=0; i<upper.size(); i++) {
+		upper[i]->place_files();
+	}
+	run_subtrees(subtrees, place_subtree_files, nthreads);
+}
+
+void Dir::place_subtree_files(Dir *dir)
+{
+	dir->place_files();
+	for(uint32_t i=0; i<dir->num_subdirs; i++) {
+		place_subtree_files(dir->get_subdir(i));
+	}
+}
+
+static void weigh_treemap_subtree(Dir *dir)
+{
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		weigh_treemap_subtree(dir->get_subdir(i));
+	}
+	weights[dir->get_id()] = weigh_contents(dir);
+}
+
+static void place_treemap_subtree(Dir *dir)
+{
+	vector<TreemapItem> items;
+	place_treemap(dir, &items);
+}
+
+static float weigh_contents(const Dir *dir)
+{
+	float weight = min_weight;
+
+	int num_files = dir->get_num_files();
+	for(int i=0; i<num_files; i++) {
+		const File *file = dir->get_file(i);
+		weight += (file->is_dup_link() ? 0 : file->get_size()) + min_weight;
+	}
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		weight += weights[dir->get_subdir(i)->get_id()];
+	}
+	return weight;
+}
+
+static void place_treemap(Dir *dir, vector<TreemapItem> *items)
+{
+	place_treemap_contents(dir, items);
+
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		place_treemap(dir->get_subdir(i), items);
+	}
+}
+
+// lays out the children of the directory on top of it, within its own box
+static void place_treemap_contents(Dir *dir, vector<TreemapItem> *items)
+{
+	Vector3 pos = dir->get_vis_pos();
+	Vector3 size = dir->get_vis_size();
+
+	items->clear();
+	int num_files = dir->get_num_files();
+	for(int i=0; i<num_files; i++) {
+		File *file = dir->get_file(i);
+		TreemapItem item;
+		item.weight = (file->is_dup_link() ? 0 : file->get_size()) + min_weight;
+		item.node = file;
+		items->push_back(item);
+	}
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		TreemapItem item;
+		item.node = dir->get_subdir(i);
+		item.weight = weights[item.node->get_id()];
+		items->push_back(item);
+	}
+	if(items->empty()) {
+		return;
+	}
+	sort(items->begin(), items->end(), heavier);
+
+	// a margin, so that the box of the directory shows around its contents
+	float pad = MIN(get_layout_param(LP_FILE_SPACING), 0.1 * MIN(size.x, size.z));
+	float x = pos.x - size.x / 2.0 + pad;
+	float z = pos.z - size.z / 2.0 + pad;
+	squarify(&(*items)[0], items->size(), x, z, size.x - pad * 2.0, size.z - pad * 2.0,
+			pos.y + size.y / 2.0);
+}
+
+/* The items go heaviest first, in rows along the shorter side of what's left
+ * of the rectangle. Items are added to a row for as long as that brings the
+ * worst aspect ratio in it closer to 1, then the row is laid out, and cut
+ * off the rectangle.
+ */
+static void squarify(const TreemapItem *items, int count, float x, float z, float width,
+		float depth, float base)
+{
+	double left = 0;
+	for(int i=0; i<count; i++) {
+		left += items[i].weight;
+	}
+
+	int start = 0;
+	while(start < count) {
+		/* the areas go by what's left of the rectangle, for the weights of
+		 * what's left to place, or rounding would pile up in the last rows
+		 */
+		float scale = width * depth / left;
+		float side = MIN(width, depth);
+		float side_sq = side * side;
+		float max_area = items[start].weight * scale;
+
+		float row_area = 0, worst = HUGE_VAL;
+		int end = start;
+		while(end < count) {
+			float area = items[end].weight * scale;
+			float sum = row_area + area;
+			// sorted, so the first is the largest and the last the smallest
+			float ratio = MAX(side_sq * max_area / (sum * sum), sum * sum / (side_sq * area));
+			if(ratio > worst) {
+				break;
+			}
+			worst = ratio;
+			row_area = sum;
+			end++;
+		}
+
+		// the last row takes all that's left
+		float longer = MAX(width, depth);
+		float thick = end == count ? longer : MIN(side > 0 ? row_area / side : 0, longer);
+		float offs = 0;
+		for(int i=start; i<end; i++) {
+			float len = thick > 0 ? items[i].weight * scale / thick : 0;
+			if(width >= depth) {
+				place_item(items[i].node, x, z + offs, thick, len, base);
+			} else {
+				place_item(items[i].node, x + offs, z, len, thick, base);
+			}
+			offs += len;
+			left -= items[i].weight;
+		}
+
+		if(width >= depth) {
+			x += thick;
+			width -= thick;
+		} else {
+			z += thick;
+			depth -= thick;
+		}
+		start = end;
+	}
+}
+
+static void place_item(FSNode *node, float x, float z, float width, float depth, float base)
+{
+	float height, footprint;
+	if(node->is_dir()) {
+		height = get_layout_param(LP_DIR_HEIGHT);
+	} else {
+		calc_file_geom((File*)node, &height, &footprint);	// the area is the footprint
+	}
+
+	float gap = MIN(get_layout_param(LP_FILE_SPACING), 0.2 * MIN(width, depth));
+	node->set_vis_pos(Vector3(x + width / 2.0, base + height / 2.0, z + depth / 2.0));
+	node->set_vis_size(Vector3(width - gap, height, depth - gap));
+}
+
+static bool heavier(const TreemapItem &a, const TreemapItem &b)
+{
+	return a.weight > b.weight;
+}
@@ -0,0 +1,1489 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <deque>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include "scan.h"
+#include "fstree.h"
+#include "arena.h"
+#include "uring.h"
+#include "watch.h"
+#include "exclude.h"
+#include "treejob.h"
+
+#ifdef HAVE_IO_URING
+#include <sys/sysmacros.h>
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC	0
+#endif
+
+using namespace std;
+
+/* An open directory shared by the jobs of its subdirectories, which open
+ * themselves relative to it with openat. It's closed when the last of them
+ * has done so, which keeps the number of open descriptors proportional to
+ * the depth of the tree being walked rather than its width.
+ */
+struct DirHandle {
+	DIR *dir;
+	int fd;
+	int refs;
+};
+
+// a directory waiting to be read, relative to its (already open) parent
+struct ScanJob {
+	Dir *dir;
+	DirHandle *parent;
+	int depth;	// below the root of the scan
+	int op;
+};
+
+/* The nodes found in one directory by a background scan, and when checking
+ * a tree, the ones which aren't there any more. Background scans never touch
+ * the tree, the batches are applied by apply_scan_results on the thread which
+ * owns it.
+ */
+struct ScanBatch {
+	Dir *dir;
+	vector<Dir*> subdirs;
+	vector<File*> files;
+	vector<FSNode*> removed;
+	ScanBatch *next;
+};
+
+// a directory for the background thread to scan or check
+struct ScanRequest {
+	Dir *dir;
+	int op;
+};
+
+struct Scanner;
+
+#define RING_SIZE	256
+#define OPEN_BATCH	16
+
+/* Every worker owns a deque of pending directories. The owner pushes and
+ * pops at the back, so each thread walks its part of the tree depth-first,
+ * while idle workers steal from the front of other deques, which tends to
+ * hand them the biggest unexplored subtrees.
+ */
+struct Worker {
+	Scanner *scan;
+	int idx;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	deque<ScanJob> jobs;
+	unsigned int rand_state;
+
+	struct uring *ring;	// null when using plain syscalls
+
+	// scratch space reused for every directory
+	vector<char> names;
+	vector<int> name_offs;
+	vector<unsigned char> types;
+	vector<const char*> name_ptrs;
+	vector<struct stat> stats;
+	vector<char> stat_ok;
+	vector<File*> file_ptrs;
+	vector<Dir*> dir_ptrs;
+	vector<FSNode*> node_ptrs;
+	vector<char> seen;
+	struct stat link_stat;	// target of the last symlink followed
+
+	/* what check_dir found gone, when not publishing, to be freed once the
+	 * workers are done: freeing runs hooks which aren't safe from here
+	 */
+	vector<pair<Dir*, FSNode*> > dead;
+#ifdef HAVE_IO_URING
+	vector<struct statx> stx;
+#endif
+};
+
+// what the jobs of a scan do with each directory
+enum {
+	OP_READ,	// read the directory and build its part of the tree
+	OP_STAT,	// fill in the metadata of files already in the tree
+	OP_CHECK	// read it again only if it changed since the last time
+};
+
+/* All the state of a single scan. Nothing here is shared between scans,
+ * and directories are only ever addressed through descriptors, so any
+ * number of scans may run concurrently with each other and with the rest
+ * of the program.
+ */
+struct Scanner {
+	bool lazy;
+	bool publish;	// hand new nodes out as batches instead of adding them
+	int max_depth;
+	bool one_fs, follow;
+	dev_t root_dev;
+	NodeArena *arena;	// of the tree
+
+	Worker *workers;
+	int num_workers;
+
+	volatile int pending;	// jobs queued or being processed
+	volatile int num_idle;
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+};
+
+static bool run_scan(int op, Dir *tree, bool publish);
+static void *worker_func(void *arg);
+static void run_worker(Worker *w);
+static void process_dir(Worker *w, Dir *tree, DirHandle *handle, int depth, int op);
+static void scan_dir(Worker *w, Dir *tree, DirHandle *handle, int depth);
+static void stat_dir(Worker *w, Dir *tree, DirHandle *handle);
+static void check_dir(Worker *w, Dir *tree, DirHandle *handle, int depth);
+static bool enter_dir(Worker *w, Dir *tree, DirHandle *handle, long long *mtime);
+static bool admit_dir(Worker *w, Dir *dir, DirHandle *handle, const char *name, struct stat *st);
+static int read_entries(Worker *w, DirHandle *handle);
+static int entry_type(Worker *w, DirHandle *handle, int idx, int *stat_idx, struct stat **st);
+static void new_entry(Worker *w, Dir *tree, ScanBatch *batch, DirHandle *handle,
+		const char *name, int type, struct stat *st, int depth);
+static bool name_less(const FSNode *a, const FSNode *b);
+static int find_node(const vector<FSNode*> &nodes, const char *name);
+static void detach_node(Dir *dir, FSNode *node);
+static void stat_batch(Worker *w, int dirfd);
+static int stat_entry(int dirfd, const char *name, struct stat *st, bool follow);
+static void open_batch(Worker *w, ScanJob *jobs, DirHandle **handles, int count);
+static DirHandle *open_dir(int dirfd, const char *name, bool follow);
+static DirHandle *wrap_dir(int fd);
+static void release_dir(DirHandle *handle);
+static int open_node_dir(const FSNode *node);
+static void push_job(Worker *w, Dir *dir, DirHandle *parent, int depth, int op);
+static int pop_jobs(Worker *w, ScanJob *jobs, int max_jobs);
+static bool steal_job(Worker *w, ScanJob *job);
+static bool have_jobs(Scanner *scan);
+static bool queue_request(Dir *dir, int op);
+static void *bg_thread_func(void *arg);
+static void publish_batch(ScanBatch *batch);
+static void calc_subtree_stats(Dir *dir);
+static void stats_node_freed(const FSNode *node);
+static bool create_rings(Scanner *scan);
+static void destroy_rings(Scanner *scan);
+#ifdef HAVE_IO_URING
+static void uring_stat_batch(Worker *w, int dirfd);
+static void uring_open_batch(Worker *w, ScanJob *jobs, DirHandle **handles, int count);
+static void statx_to_stat(const struct statx *stx, struct stat *st);
+#endif
+
+static int num_threads;
+static int meta_mode = SCAN_META_EAGER;
+static int backend = SCAN_BACKEND_POSIX;
+static int max_depth;
+static bool one_fs, follow_links;
+static ExcludeList excludes;
+
+/* Background scans are served one at a time by a single thread, which runs
+ * a full parallel scan rooted at the requested directory. The request queue
+ * and the counters below are protected by bg_lock.
+ */
+static pthread_t bg_thread;
+static bool bg_started;
+static pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bg_cond = PTHREAD_COND_INITIALIZER;
+static deque<ScanRequest> bg_requests;
+static int bg_active;		// requests being worked on by the background thread
+static bool res_applying;	// apply_scan_results is attaching a list of batches
+
+/* Finished batches are pushed by the workers onto a lock-free stack, the
+ * consumer grabs the whole stack with a single exchange, and reverses it to
+ * get them back in the order they were published. With a single consumer
+ * which never pops individual items there's no ABA problem to worry about.
+ */
+static ScanBatch *volatile res_stack;
+
+static volatile long num_scanned;	// entries found by all scans so far
+
+// directories changed by apply_scan_results, to update their aggregates
+static set<Dir*> stats_dirs;
+static bool stats_hook;
+
+static vector<void (*)(Dir*)> attach_funcs;
+
+void set_scan_threads(int num)
+{
+	num_threads = num;
+}
+
+int get_scan_threads()
+{
+	if(num_threads > 0) {
+		return num_threads;
+	}
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	return ncpu > 0 ? (int)ncpu : 1;
+}
+
+void set_scan_metadata(int mode)
+{
+	meta_mode = mode;
+}
+
+int get_scan_metadata()
+{
+	return meta_mode;
+}
+
+void set_scan_backend(int bend)
+{
+	backend = bend;
+}
+
+int get_scan_backend()
+{
+	return backend;
+}
+
+void set_scan_depth(int depth)
+{
+	max_depth = depth;
+}
+
+int get_scan_depth()
+{
+	return max_depth;
+}
+
+void set_scan_one_fs(bool one)
+{
+	one_fs = one;
+}
+
+bool get_scan_one_fs()
+{
+	return one_fs;
+}
+
+void set_scan_follow_links(bool follow)
+{
+	follow_links = follow;
+}
+
+bool get_scan_follow_links()
+{
+	return follow_links;
+}
+
+void add_scan_exclude(const char *glob)
+{
+	excludes.add(glob);
+}
+
+void clear_scan_excludes()
+{
+	excludes.clear();
+}
+
+bool build_tree(Dir *tree, const char *dirname)
+{
+	tree->set_name(dirname);
+	return run_scan(OP_READ, tree, false);
+}
+
+bool fill_metadata(Dir *tree)
+{
+	return run_scan(OP_STAT, tree, false);
+}
+
+bool refresh_tree(Dir *tree)
+{
+	if(!run_scan(OP_CHECK, tree, false)) {
+		return false;
+	}
+	if(meta_mode == SCAN_META_LAZY) {
+		return run_scan(OP_STAT, tree, false);
+	}
+	return true;
+}
+
+bool stat_file(File *file)
+{
+	int fd = open_node_dir(file->get_parent());
+	if(fd == -1) {
+		file->set_stat_failed(true);
+		return false;
+	}
+
+	struct stat st;
+	int res = stat_entry(fd, file->get_name(), &st, follow_links);
+	if(res == -1) {
+		fprintf(stderr, "%s: stat failed: %s\n", file->get_name(), strerror(errno));
+	}
+	close(fd);
+
+	if(res == -1) {
+		file->set_stat_failed(true);
+		return false;
+	}
+	file->set_stat(&st);
+	return true;
+}
+
+bool start_scan(Dir *tree, const char *dirname)
+{
+	tree->set_name(dirname);
+
+	// make sure the root is there, so we can fail early
+	int fd = open_node_dir(tree);
+	if(fd == -1) {
+		return false;
+	}
+	close(fd);
+
+	return scan_async(tree);
+}
+
+bool scan_async(Dir *dir)
+{
+	return queue_request(dir, OP_READ);
+}
+
+bool start_refresh(Dir *tree)
+{
+	return queue_request(tree, OP_CHECK);
+}
+
+static bool queue_request(Dir *dir, int op)
+{
+	pthread_mutex_lock(&bg_lock);
+	if(!bg_started) {
+		if(pthread_create(&bg_thread, 0, bg_thread_func, 0) != 0) {
+			fprintf(stderr, "failed to start background scan thread: %s\n", strerror(errno));
+			pthread_mutex_unlock(&bg_lock);
+			return false;
+		}
+		pthread_detach(bg_thread);
+		bg_started = true;
+	}
+
+	if(op == OP_READ) {
+		dir->set_expanded(true);
+		dir->set_skipped(false);
+	}
+
+	ScanRequest req;
+	req.dir = dir;
+	req.op = op;
+	bg_requests.push_back(req);
+	pthread_cond_broadcast(&bg_cond);
+	pthread_mutex_unlock(&bg_lock);
+	return true;
+}
+
+bool apply_scan_results()
+{
+	pthread_mutex_lock(&bg_lock);
+	ScanBatch *list = __sync_lock_test_and_set(&res_stack, (ScanBatch*)0);
+	res_applying = list != 0;
+	pthread_mutex_unlock(&bg_lock);
+
+	if(!list) {
+		return false;
+	}
+
+	if(!stats_hook) {
+		// a later batch may free a directory changed by an earlier one
+		add_node_free_func(stats_node_freed);
+		stats_hook = true;
+	}
+
+	ScanBatch *batch = 0;
+	while(list) {
+		ScanBatch *next = list->next;
+		list->next = batch;
+		batch = list;
+		list = next;
+	}
+
+	lock_tree();
+	while(batch) {
+		ScanBatch *next = batch->next;
+
+		for(size_t i=0; i<batch->removed.size(); i++) {
+			detach_node(batch->dir, batch->removed[i]);
+			free_node(batch->removed[i]);
+		}
+		for(size_t i=0; i<batch->subdirs.size(); i++) {
+			batch->dir->add_subdir(batch->subdirs[i]);
+			for(size_t j=0; j<attach_funcs.size(); j++) {
+				attach_funcs[j](batch->subdirs[i]);
+			}
+		}
+		for(size_t i=0; i<batch->files.size(); i++) {
+			batch->dir->add_file(batch->files[i]);
+		}
+		stats_dirs.insert(batch->dir);
+		delete batch;
+		batch = next;
+	}
+
+	vector<Dir*> dirs(stats_dirs.begin(), stats_dirs.end());
+	take_relinked_dirs(&dirs);
+	update_stats(dirs);
+	stats_dirs.clear();
+	unlock_tree();
+
+	pthread_mutex_lock(&bg_lock);
+	res_applying = false;
+	pthread_cond_broadcast(&bg_cond);
+	pthread_mutex_unlock(&bg_lock);
+	return true;
+}
+
+void add_scan_attach_func(void (*func)(Dir*))
+{
+	attach_funcs.push_back(func);
+}
+
+bool scan_pending()
+{
+	pthread_mutex_lock(&bg_lock);
+	bool res = !bg_requests.empty() || bg_active || res_stack || res_applying;
+	pthread_mutex_unlock(&bg_lock);
+	return res;
+}
+
+static void *bg_thread_func(void *arg)
+{
+	for(;;) {
+		pthread_mutex_lock(&bg_lock);
+		while(bg_requests.empty()) {
+			pthread_cond_wait(&bg_cond, &bg_lock);
+		}
+		ScanRequest req = bg_requests.front();
+		bg_requests.pop_front();
+		bg_active++;
+		pthread_mutex_unlock(&bg_lock);
+
+		Dir *dir = req.dir;
+		run_scan(req.op, dir, true);
+
+		if(meta_mode == SCAN_META_LAZY) {
+			/* the metadata pass walks the tree, so it has to wait until
+			 * everything we found is attached to it.
+			 */
+			pthread_mutex_lock(&bg_lock);
+			while(res_stack || res_applying) {
+				pthread_cond_wait(&bg_cond, &bg_lock);
+			}
+			pthread_mutex_unlock(&bg_lock);
+
+			run_scan(OP_STAT, dir, false);
+		}
+
+		pthread_mutex_lock(&bg_lock);
+		bg_active--;
+		pthread_mutex_unlock(&bg_lock);
+	}
+	return 0;
+}
+
+long get_scan_count()
+{
+	return num_scanned;
+}
+
+/* The directories a few levels down are done first, each one depth first by
+ * whichever thread gets to it, and then the levels above them bottom-up.
+ */
+void calc_tree_stats(Dir *dir)
+{
+	int nthreads = get_scan_threads();
+	vector<Dir*> upper, subtrees;
+
+	split_tree(dir, nthreads, &upper, &subtrees);
+	run_subtrees(subtrees, calc_subtree_stats, nthreads);
+
+	for(size_t i=upper.size(); i>0; i--) {
+		upper[i - 1]->calc_stats();
+	}
+
+	if(dir->get_parent()) {
+		update_stats(vector<Dir*>(1, (Dir*)dir->get_parent()));
+	}
+}
+
+static void calc_subtree_stats(Dir *dir)
+{
+	int num_subdirs = dir->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		calc_subtree_stats(dir->get_subdir(i));
+	}
+	dir->calc_stats();
+}
+
+static void stats_node_freed(const FSNode *node)
+{
+	if(!stats_dirs.empty()) {
+		stats_dirs.erase((Dir*)node);
+	}
+}
+
+static void publish_batch(ScanBatch *batch)
+{
+	ScanBatch *head;
+	do {
+		head = res_stack;
+		batch->next = head;
+	} while(!__sync_bool_compare_and_swap(&res_stack, head, batch));
+}
+
+static bool run_scan(int op, Dir *tree, bool publish)
+{
+	Scanner scan;
+	DirHandle *root;
+	int fd;
+
+	// the root itself may be a symlink, everything below it is not followed
+	if((fd = open_node_dir(tree)) == -1) {
+		return false;
+	}
+	if(!(root = wrap_dir(fd))) {
+		fprintf(stderr, "failed to open dir: %s: %s\n", tree->get_name(), strerror(errno));
+		return false;
+	}
+
+	scan.lazy = meta_mode == SCAN_META_LAZY;
+	scan.publish = publish;
+	scan.max_depth = max_depth;
+	scan.one_fs = one_fs;
+	scan.follow = follow_links;
+	scan.arena = tree->get_arena();
+
+	struct stat st;
+	scan.root_dev = fstat(fd, &st) == -1 ? 0 : st.st_dev;
+
+	scan.num_workers = get_scan_threads();
+	scan.workers = new Worker[scan.num_workers];
+	scan.pending = 0;
+	scan.num_idle = 0;
+	pthread_mutex_init(&scan.idle_lock, 0);
+	pthread_cond_init(&scan.idle_cond, 0);
+
+	for(int i=0; i<scan.num_workers; i++) {
+		scan.workers[i].scan = &scan;
+		scan.workers[i].idx = i;
+		scan.workers[i].rand_state = i + 1;
+		scan.workers[i].ring = 0;
+		pthread_mutex_init(&scan.workers[i].lock, 0);
+	}
+
+	if(backend == SCAN_BACKEND_URING) {
+		create_rings(&scan);
+	}
+
+	/* the root is handled by the calling thread before any workers are
+	 * started, so that its subdirectories are already queued for stealing.
+	 */
+	process_dir(scan.workers, tree, root, 0, op);
+
+	for(int i=1; i<scan.num_workers; i++) {
+		if(pthread_create(&scan.workers[i].thread, 0, worker_func, scan.workers + i) != 0) {
+			fprintf(stderr, "failed to start scanner thread: %s\n", strerror(errno));
+			scan.workers[i].thread = 0;
+		}
+	}
+
+	run_worker(scan.workers);
+
+	for(int i=1; i<scan.num_workers; i++) {
+		if(scan.workers[i].thread) {
+			pthread_join(scan.workers[i].thread, 0);
+		}
+	}
+
+	destroy_rings(&scan);
+	vector<pair<Dir*, FSNode*> > dead;
+	for(int i=0; i<scan.num_workers; i++) {
+		pthread_mutex_destroy(&scan.workers[i].lock);
+		dead.insert(dead.end(), scan.workers[i].dead.begin(), scan.workers[i].dead.end());
+	}
+	delete [] scan.workers;
+
+	pthread_mutex_destroy(&scan.idle_lock);
+	pthread_cond_destroy(&scan.idle_cond);
+
+	// published batches are accounted for by apply_scan_results instead
+	if(!publish) {
+		lock_tree();
+		for(size_t i=0; i<dead.size(); i++) {
+			detach_node(dead[i].first, dead[i].second);
+			free_node(dead[i].second);
+		}
+		calc_tree_stats(tree);
+		// links elsewhere may have taken over from files freed or changed here
+		vector<Dir*> dirs;
+		take_relinked_dirs(&dirs);
+		update_stats(dirs);
+		unlock_tree();
+	}
+	return true;
+}
+
+static void *worker_func(void *arg)
+{
+	Worker *w = (Worker*)arg;
+	run_worker(w);
+	// what's left of the blocks and ids this thread took, for the next ones
+	w->scan->arena->release_thread_cache();
+	return 0;
+}
+
+static void run_worker(Worker *w)
+{
+	Scanner *scan = w->scan;
+	ScanJob jobs[OPEN_BATCH];
+	DirHandle *handles[OPEN_BATCH];
+
+	for(;;) {
+		// with io_uring, open a few of our own directories at once
+		int count = pop_jobs(w, jobs, w->ring ? OPEN_BATCH : 1);
+		if(!count && steal_job(w, jobs)) {
+			count = 1;
+		}
+
+		if(count) {
+			open_batch(w, jobs, handles, count);
+
+			for(int i=0; i<count; i++) {
+				if(handles[i]) {
+					process_dir(w, jobs[i].dir, handles[i], jobs[i].depth, jobs[i].op);
+				}
+				release_dir(jobs[i].parent);
+
+				if(__sync_sub_and_fetch(&scan->pending, 1) == 0) {
+					// that was the last one, wake everyone up so they can quit
+					pthread_mutex_lock(&scan->idle_lock);
+					pthread_cond_broadcast(&scan->idle_cond);
+					pthread_mutex_unlock(&scan->idle_lock);
+				}
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&scan->idle_lock);
+		if(!scan->pending) {
+			pthread_mutex_unlock(&scan->idle_lock);
+			break;
+		}
+
+		/* announce that we're going to sleep before checking the queues
+		 * one last time, push_job checks num_idle after queuing, so one of
+		 * us is bound to see the other.
+		 */
+		__sync_add_and_fetch(&scan->num_idle, 1);
+		if(!have_jobs(scan)) {
+			pthread_cond_wait(&scan->idle_cond, &scan->idle_lock);
+		}
+		__sync_sub_and_fetch(&scan->num_idle, 1);
+		pthread_mutex_unlock(&scan->idle_lock);
+	}
+}
+
+// handles an open directory according to the op of its job, and drops our reference
+static void process_dir(Worker *w, Dir *tree, DirHandle *handle, int depth, int op)
+{
+	switch(op) {
+	case OP_READ:
+		scan_dir(w, tree, handle, depth);
+		break;
+
+	case OP_STAT:
+		stat_dir(w, tree, handle);
+		break;
+
+	case OP_CHECK:
+		check_dir(w, tree, handle, depth);
+		break;
+	}
+	release_dir(handle);
+}
+
+/* reads a directory and queues its subdirectories. Its mtime is recorded
+ * before reading, so that if it changes in the meantime, the next check
+ * reads it again.
+ */
+static void scan_dir(Worker *w, Dir *tree, DirHandle *handle, int depth)
+{
+	/* subdirectories went by the scan policy when they were created, see
+	 * new_entry, so this is one of those, or the root of the scan, which was
+	 * asked for, and is read even if it's a stub the policy left
+	 */
+	long long mtime;
+	enter_dir(w, tree, handle, &mtime);
+
+	ScanBatch *batch = w->scan->publish ? new ScanBatch : 0;
+
+	// before reading it, so that no change made in the meantime is missed
+	watch_dir(tree, handle->fd);
+	tree->set_mtime(mtime);
+
+	int num_ent = read_entries(w, handle);
+
+	int stat_idx = 0;
+	for(int i=0; i<num_ent; i++) {
+		struct stat *st;
+		int type = entry_type(w, handle, i, &stat_idx, &st);
+		if(type != DT_UNKNOWN) {
+			new_entry(w, tree, batch, handle, &w->names[w->name_offs[i]], type, st, depth);
+		}
+	}
+
+	if(batch) {
+		batch->dir = tree;
+		publish_batch(batch);
+	}
+}
+
+/* fills in the metadata of the files of a directory, and queues its
+ * subdirectories. The tree may be growing while we're at it, so the child
+ * lists are copied under the tree lock.
+ */
+static void stat_dir(Worker *w, Dir *tree, DirHandle *handle)
+{
+	w->file_ptrs.clear();
+	w->dir_ptrs.clear();
+
+	lock_tree();
+	int num_files = tree->get_num_files();
+	for(int i=0; i<num_files; i++) {
+		File *file = tree->get_file(i);
+		if(!file->have_stat()) {
+			w->file_ptrs.push_back(file);
+		}
+	}
+	int num_subdirs = tree->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		w->dir_ptrs.push_back(tree->get_subdir(i));
+	}
+	unlock_tree();
+
+	w->name_ptrs.clear();
+	for(size_t i=0; i<w->file_ptrs.size(); i++) {
+		w->name_ptrs.push_back(w->file_ptrs[i]->get_name());
+	}
+	stat_batch(w, handle->fd);
+
+	for(size_t i=0; i<w->file_ptrs.size(); i++) {
+		if(w->stat_ok[i]) {
+			w->file_ptrs[i]->set_stat(&w->stats[i]);
+		}
+	}
+
+	for(size_t i=0; i<w->dir_ptrs.size(); i++) {
+		push_job(w, w->dir_ptrs[i], handle, 0, OP_STAT);
+	}
+}
+
+/* Checks a directory against the last time it was read, going by its mtime,
+ * which changes whenever entries are added, removed or renamed. If it's the
+ * same, only its subdirectories are checked in turn. Otherwise it's read
+ * again and diffed against its child lists: new entries are added, new
+ * subdirectories are scanned in full, and missing entries are removed. In
+ * eager mode the files which are still there are stat'ed again as well.
+ */
+static void check_dir(Worker *w, Dir *tree, DirHandle *handle, int depth)
+{
+	long long mtime;
+	if(!enter_dir(w, tree, handle, &mtime)) {
+		return;	// left as it is
+	}
+	watch_dir(tree, handle->fd);
+
+	w->node_ptrs.clear();
+
+	lock_tree();
+	int num_subdirs = tree->get_num_subdirs();
+	for(int i=0; i<num_subdirs; i++) {
+		w->node_ptrs.push_back(tree->get_subdir(i));
+	}
+	int num_files = tree->get_num_files();
+	for(int i=0; i<num_files; i++) {
+		w->node_ptrs.push_back(tree->get_file(i));
+	}
+	unlock_tree();
+
+	if(mtime && mtime == tree->get_mtime()) {
+		for(int i=0; i<num_subdirs; i++) {
+			Dir *dir = (Dir*)w->node_ptrs[i];
+			if(dir->is_expanded()) {
+				push_job(w, dir, handle, depth + 1, OP_CHECK);
+			}
+		}
+		return;
+	}
+	tree->set_mtime(mtime);
+
+	ScanBatch *batch = w->scan->publish ? new ScanBatch : 0;
+
+	// sorted by name, to look up the entries as we read them
+	sort(w->node_ptrs.begin(), w->node_ptrs.end(), name_less);
+	w->seen.assign(w->node_ptrs.size(), 0);
+
+	int num_ent = read_entries(w, handle);
+
+	int stat_idx = 0;
+	for(int i=0; i<num_ent; i++) {
+		const char *name = &w->names[w->name_offs[i]];
+		struct stat *st;
+		int type = entry_type(w, handle, i, &stat_idx, &st);
+		if(type == DT_UNKNOWN) {
+			continue;
+		}
+
+		int idx = find_node(w->node_ptrs, name);
+		if(idx >= 0) {
+			FSNode *node = w->node_ptrs[idx];
+			Dir *dir = node->is_dir() ? (Dir*)node : 0;
+
+			if((dir != 0) == (type == DT_DIR)) {
+				w->seen[idx] = 1;
+				if(dir) {
+					if(dir->is_expanded()) {
+						push_job(w, dir, handle, depth + 1, OP_CHECK);
+					}
+				} else if(st) {
+					((File*)node)->set_stat(st);
+				}
+				continue;
+			}
+			// otherwise it was replaced by something of another type
+		}
+
+		new_entry(w, tree, batch, handle, name, type, st, depth);
+	}
+
+	for(size_t i=0; i<w->node_ptrs.size(); i++) {
+		if(w->seen[i]) {
+			continue;
+		}
+		if(batch) {
+			batch->removed.push_back(w->node_ptrs[i]);
+		} else {
+			w->dead.push_back(make_pair(tree, w->node_ptrs[i]));
+		}
+	}
+
+	if(batch) {
+		batch->dir = tree;
+		publish_batch(batch);
+	}
+}
+
+/* stats a directory about to be read for its mtime (0 if unknown), and checks
+ * it against the scan policy. Returns false if it's on another filesystem in
+ * one-filesystem mode, or if it's in the tree already by another path.
+ * Claiming the inode again for the same directory is harmless.
+ */
+static bool enter_dir(Worker *w, Dir *tree, DirHandle *handle, long long *mtime)
+{
+	struct stat st;
+
+	if(fstat(handle->fd, &st) == -1) {
+		*mtime = 0;
+		return true;
+	}
+#ifdef __linux__
+	*mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+	*mtime = st.st_mtime * 1000000000LL;
+#endif
+
+	if(w->scan->one_fs && st.st_dev != w->scan->root_dev) {
+		return false;
+	}
+	return tree->claim_inode(st.st_dev, st.st_ino);
+}
+
+/* reads all the entries of a directory into the worker's scratch arrays. In
+ * lazy mode entries are classified by their d_type alone, and only
+ * filesystems which don't fill it in pay for a stat at this point. The
+ * entries are read in full before any of them is stat'ed, so that the stats
+ * can be submitted as one batch. Excluded names are skipped right away, and
+ * never stat'ed. Returns the number of entries.
+ */
+static int read_entries(Worker *w, DirHandle *handle)
+{
+	struct dirent *dent;
+	bool lazy = w->scan->lazy;
+
+	w->names.clear();
+	w->name_offs.clear();
+	w->types.clear();
+
+	while((dent = readdir(handle->dir))) {
+		if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
+			continue;
+		}
+		if(!excludes.empty() && excludes.match(dent->d_name)) {
+			continue;
+		}
+
+		w->name_offs.push_back(w->names.size());
+		w->names.insert(w->names.end(), dent->d_name, dent->d_name + strlen(dent->d_name) + 1);
+		w->types.push_back(lazy ? dent->d_type : DT_UNKNOWN);
+	}
+
+	int num_ent = (int)w->name_offs.size();
+	__sync_add_and_fetch(&num_scanned, num_ent);
+
+	// names of the entries we don't know the type of, in entry order
+	w->name_ptrs.clear();
+	for(int i=0; i<num_ent; i++) {
+		if(w->types[i] == DT_UNKNOWN) {
+			w->name_ptrs.push_back(&w->names[w->name_offs[i]]);
+		}
+	}
+	stat_batch(w, handle->fd);
+	return num_ent;
+}
+
+/* returns the type of an entry read by read_entries, and its stat buffer if
+ * it had to be stat'ed. Must be called for the entries in order, stat_idx
+ * starting at 0. Returns DT_UNKNOWN if the stat failed. When following
+ * symlinks, a link is stat'ed again for its target, unless it's broken.
+ */
+static int entry_type(Worker *w, DirHandle *handle, int idx, int *stat_idx, struct stat **st)
+{
+	int type = w->types[idx];
+
+	*st = 0;
+	if(type == DT_UNKNOWN) {
+		int sidx = (*stat_idx)++;
+		if(!w->stat_ok[sidx]) {
+			return DT_UNKNOWN;
+		}
+		*st = &w->stats[sidx];
+		type = IFTODT((*st)->st_mode);
+	}
+
+	if(type == DT_LNK && w->scan->follow) {
+		const char *name = &w->names[w->name_offs[idx]];
+		if(fstatat(handle->fd, name, &w->link_stat, 0) == 0) {
+			*st = &w->link_stat;
+			type = IFTODT(w->link_stat.st_mode);
+		}
+	}
+	return type;
+}
+
+/* creates the node for a new entry, and queues it to be read if it's a
+ * directory. Subdirectories beyond the depth budget are left as unexpanded
+ * stubs, and so are the ones the scan policy skips, which are marked as such
+ * here, before the node is published or attached.
+ */
+static void new_entry(Worker *w, Dir *tree, ScanBatch *batch, DirHandle *handle,
+		const char *name, int type, struct stat *st, int depth)
+{
+	Scanner *scan = w->scan;
+
+	if(type == DT_DIR) {
+		Dir *node = new_dir(tree->get_arena());
+		node->set_name(name);
+
+		bool stub = scan->max_depth > 0 && depth + 1 > scan->max_depth;
+		if(!stub && !admit_dir(w, node, handle, name, st)) {
+			node->set_skipped(true);
+			stub = true;
+		}
+		node->set_expanded(!stub);
+		if(batch) {
+			node->set_parent(tree);
+			batch->subdirs.push_back(node);
+		} else {
+			tree->add_subdir(node);
+		}
+
+		if(!stub) {
+			push_job(w, node, handle, depth + 1, OP_READ);
+		}
+	} else {
+		File *file = new_file(tree->get_arena());
+		file->set_name(name);
+		if(st) {
+			file->set_stat(st);
+		} else {
+			file->set_mode(DTTOIF(type));
+		}
+		if(batch) {
+			file->set_parent(tree);
+			batch->files.push_back(file);
+		} else {
+			tree->add_file(file);
+		}
+	}
+}
+
+/* checks a new subdirectory against the scan policy, like enter_dir does
+ * once it's open, by its stat buffer if the entry was stat'ed. In lazy mode
+ * it's stat'ed here, directories being few next to the files.
+ */
+static bool admit_dir(Worker *w, Dir *dir, DirHandle *handle, const char *name, struct stat *st)
+{
+	struct stat buf;
+
+	if(!st) {
+		if(fstatat(handle->fd, name, &buf, AT_SYMLINK_NOFOLLOW) == -1) {
+			return true;	// opening it will fail as well
+		}
+		st = &buf;
+	}
+
+	if(w->scan->one_fs && st->st_dev != w->scan->root_dev) {
+		return false;
+	}
+	return dir->claim_inode(st->st_dev, st->st_ino);
+}
+
+static bool name_less(const FSNode *a, const FSNode *b)
+{
+	return strcmp(a->get_name(), b->get_name()) < 0;
+}
+
+// binary search in a list of nodes sorted with name_less, returns -1 if not found
+static int find_node(const vector<FSNode*> &nodes, const char *name)
+{
+	int lo = 0, hi = (int)nodes.size() - 1;
+
+	while(lo <= hi) {
+		int mid = (lo + hi) / 2;
+		int res = strcmp(name, nodes[mid]->get_name());
+		if(res == 0) {
+			return mid;
+		}
+		if(res < 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return -1;
+}
+
+static void detach_node(Dir *dir, FSNode *node)
+{
+	if(node->is_dir()) {
+		dir->remove_subdir((Dir*)node);
+	} else {
+		dir->remove_file((File*)node);
+	}
+}
+
+/* stats the names in w->name_ptrs relative to dirfd into w->stats, setting
+ * w->stat_ok for the ones which succeeded.
+ */
+static void stat_batch(Worker *w, int dirfd)
+{
+	int count = (int)w->name_ptrs.size();
+	const char **names = count ? &w->name_ptrs[0] : 0;
+	bool follow = w->scan->follow;
+
+	w->stats.resize(count);
+	w->stat_ok.assign(count, 0);
+
+#ifdef HAVE_IO_URING
+	if(w->ring) {
+		uring_stat_batch(w, dirfd);
+		return;
+	}
+#endif
+
+	for(int i=0; i<count; i++) {
+		if(stat_entry(dirfd, names[i], &w->stats[i], follow) == -1) {
+			fprintf(stderr, "%s: stat failed: %s\n", names[i], strerror(errno));
+			continue;
+		}
+		w->stat_ok[i] = 1;
+	}
+}
+
+/* stats an entry, or the target of it if it's a symlink and we follow them.
+ * Broken links, and loops, are stat'ed as links instead, like entry_type
+ * leaves them.
+ */
+static int stat_entry(int dirfd, const char *name, struct stat *st, bool follow)
+{
+	if(!follow) {
+		return fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW);
+	}
+	if(fstatat(dirfd, name, st, 0) == 0) {
+		return 0;
+	}
+	if(errno != ENOENT && errno != ELOOP) {
+		return -1;
+	}
+	return fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW);
+}
+
+// opens the directories of a number of jobs, failures leave a null handle
+static void open_batch(Worker *w, ScanJob *jobs, DirHandle **handles, int count)
+{
+#ifdef HAVE_IO_URING
+	if(w->ring) {
+		uring_open_batch(w, jobs, handles, count);
+		return;
+	}
+#endif
+
+	for(int i=0; i<count; i++) {
+		const char *name = jobs[i].dir->get_name();
+		if(!(handles[i] = open_dir(jobs[i].parent->fd, name, w->scan->follow))) {
+			fprintf(stderr, "failed to open dir: %s: %s\n", name, strerror(errno));
+		}
+	}
+}
+
+static DirHandle *open_dir(int dirfd, const char *name, bool follow)
+{
+	int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+	if(dirfd != AT_FDCWD && !follow) {
+		flags |= O_NOFOLLOW;
+	}
+
+	int fd = openat(dirfd, name, flags);
+	if(fd == -1) {
+		return 0;
+	}
+	return wrap_dir(fd);
+}
+
+static DirHandle *wrap_dir(int fd)
+{
+	DIR *dir = fdopendir(fd);
+	if(!dir) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return 0;
+	}
+
+	DirHandle *handle = new DirHandle;
+	handle->dir = dir;
+	handle->fd = fd;
+	handle->refs = 1;
+	return handle;
+}
+
+static void release_dir(DirHandle *handle)
+{
+	if(__sync_sub_and_fetch(&handle->refs, 1) == 0) {
+		closedir(handle->dir);
+		delete handle;
+	}
+}
+
+/* opens a directory of the tree by walking down from the root one openat at
+ * a time, so it works for paths of any length. Returns a descriptor or -1.
+ */
+static int open_node_dir(const FSNode *node)
+{
+	vector<const char*> names;
+	while(node) {
+		names.push_back(node->get_name());
+		node = node->get_parent();
+	}
+	if(names.empty()) {
+		return -1;
+	}
+
+	int fd = AT_FDCWD;
+	for(size_t i=names.size(); i>0; i--) {
+		int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+		if(fd != AT_FDCWD && !follow_links) {
+			flags |= O_NOFOLLOW;
+		}
+
+		int next = openat(fd, names[i - 1], flags);
+		if(next == -1) {
+			fprintf(stderr, "failed to open dir: %s: %s\n", names[i - 1], strerror(errno));
+		}
+		if(fd != AT_FDCWD) {
+			close(fd);
+		}
+		if((fd = next) == -1) {
+			return -1;
+		}
+	}
+	return fd;
+}
+
+static void push_job(Worker *w, Dir *dir, DirHandle *parent, int depth, int op)
+{
+	Scanner *scan = w->scan;
+
+	ScanJob job;
+	job.dir = dir;
+	job.parent = parent;
+	job.depth = depth;
+	job.op = op;
+
+	__sync_add_and_fetch(&parent->refs, 1);
+	__sync_add_and_fetch(&scan->pending, 1);
+
+	pthread_mutex_lock(&w->lock);
+	w->jobs.push_back(job);
+	pthread_mutex_unlock(&w->lock);
+
+	__sync_synchronize();
+	if(scan->num_idle) {
+		pthread_mutex_lock(&scan->idle_lock);
+		pthread_cond_signal(&scan->idle_cond);
+		pthread_mutex_unlock(&scan->idle_lock);
+	}
+}
+
+static int pop_jobs(Worker *w, ScanJob *jobs, int max_jobs)
+{
+	int count = 0;
+
+	pthread_mutex_lock(&w->lock);
+	while(count < max_jobs && !w->jobs.empty()) {
+		jobs[count++] = w->jobs.back();
+		w->jobs.pop_back();
+	}
+	pthread_mutex_unlock(&w->lock);
+	return count;
+}
+
+static bool steal_job(Worker *w, ScanJob *job)
+{
+	Scanner *scan = w->scan;
+
+	if(scan->num_workers < 2) {
+		return false;
+	}
+
+	int start = rand_r(&w->rand_state) % scan->num_workers;
+
+	for(int i=0; i<scan->num_workers; i++) {
+		Worker *victim = scan->workers + (start + i) % scan->num_workers;
+		if(victim == w) {
+			continue;
+		}
+
+		bool res = false;
+		pthread_mutex_lock(&victim->lock);
+		if(!victim->jobs.empty()) {
+			*job = victim->jobs.front();
+			victim->jobs.pop_front();
+			res = true;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if(res) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool have_jobs(Scanner *scan)
+{
+	for(int i=0; i<scan->num_workers; i++) {
+		pthread_mutex_lock(&scan->workers[i].lock);
+		bool empty = scan->workers[i].jobs.empty();
+		pthread_mutex_unlock(&scan->workers[i].lock);
+
+		if(!empty) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool create_rings(Scanner *scan)
+{
+	static bool warned;
+
+	for(int i=0; i<scan->num_workers; i++) {
+		if(!(scan->workers[i].ring = uring_create(RING_SIZE))) {
+			if(!warned) {
+				fprintf(stderr, "io_uring unavailable (%s), falling back to plain syscalls\n",
+						strerror(errno));
+				warned = true;
+			}
+			destroy_rings(scan);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void destroy_rings(Scanner *scan)
+{
+	for(int i=0; i<scan->num_workers; i++) {
+		if(scan->workers[i].ring) {
+			uring_destroy(scan->workers[i].ring);
+			scan->workers[i].ring = 0;
+		}
+	}
+}
+
+#ifdef HAVE_IO_URING
+#define STAT_FAILED	2	// as opposed to never submitted
+
+#define STATX_MASK	(STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | \
+		STATX_ATIME | STATX_MTIME | STATX_CTIME | STATX_INO | STATX_SIZE)
+
+/* keeps up to RING_SIZE statx requests in flight until the whole batch is
+ * done. If the ring breaks down for some reason, the requests the kernel has
+ * already taken are waited for, since they write into w->stx, then the worker
+ * drops the ring and stats whatever is left the old fashioned way.
+ */
+static void uring_stat_batch(Worker *w, int dirfd)
+{
+	struct uring *ring = w->ring;
+	int count = (int)w->name_ptrs.size();
+	const char **names = count ? &w->name_ptrs[0] : 0;
+	bool follow = w->scan->follow;
+	int flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+	int next = 0, inflight = 0;
+	bool broken = false;
+
+	w->stx.resize(count);
+
+	while(next < count || inflight > 0) {
+		if(broken) {
+			if(!uring_inflight(ring) || uring_wait(ring) == -1) {
+				break;
+			}
+		} else {
+			while(next < count && inflight < RING_SIZE) {
+				if(uring_statx(ring, dirfd, names[next], flags, STATX_MASK,
+							&w->stx[next], next) == -1) {
+					break;
+				}
+				next++;
+				inflight++;
+			}
+
+			if(uring_submit(ring, 1) == -1) {
+				fprintf(stderr, "io_uring submit failed: %s\n", strerror(errno));
+				broken = true;
+			}
+		}
+
+		unsigned long idx;
+		int res;
+		while(uring_complete(ring, &idx, &res)) {
+			inflight--;
+			if(res < 0 && follow && (res == -ENOENT || res == -ELOOP)) {
+				continue;	// maybe a broken link, left to stat_entry below
+			}
+			if(res < 0) {
+				fprintf(stderr, "%s: stat failed: %s\n", names[idx], strerror(-res));
+				w->stat_ok[idx] = STAT_FAILED;
+				continue;
+			}
+			statx_to_stat(&w->stx[idx], &w->stats[idx]);
+			w->stat_ok[idx] = 1;
+		}
+	}
+
+	if(broken) {
+		uring_destroy(ring);
+		w->ring = 0;
+	}
+
+	for(int i=0; i<count; i++) {
+		if(w->stat_ok[i] == STAT_FAILED) {
+			w->stat_ok[i] = 0;
+		} else if(!w->stat_ok[i]) {
+			if(stat_entry(dirfd, names[i], &w->stats[i], follow) == -1) {
+				fprintf(stderr, "%s: stat failed: %s\n", names[i], strerror(errno));
+				continue;
+			}
+			w->stat_ok[i] = 1;
+		}
+	}
+}
+
+static void uring_open_batch(Worker *w, ScanJob *jobs, DirHandle **handles, int count)
+{
+	struct uring *ring = w->ring;
+	int fds[OPEN_BATCH];
+	int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+	int inflight = 0;
+
+	if(!w->scan->follow) {
+		flags |= O_NOFOLLOW;
+	}
+
+	for(int i=0; i<count; i++) {
+		fds[i] = -2;	// not done yet
+		if(uring_openat(ring, jobs[i].parent->fd, jobs[i].dir->get_name(), flags, i) != -1) {
+			inflight++;
+		}
+	}
+
+	bool broken = false;
+	while(inflight > 0) {
+		if(broken) {
+			if(!uring_inflight(ring) || uring_wait(ring) == -1) {
+				break;
+			}
+		} else if(uring_submit(ring, 1) == -1) {
+			// the opens the kernel took are reaped all the same, or their fds would leak
+			fprintf(stderr, "io_uring submit failed: %s\n", strerror(errno));
+			broken = true;
+		}
+
+		unsigned long idx;
+		int res;
+		while(uring_complete(ring, &idx, &res)) {
+			inflight--;
+			fds[idx] = res;
+		}
+	}
+
+	if(broken) {
+		uring_destroy(ring);
+		w->ring = 0;
+	}
+
+	for(int i=0; i<count; i++) {
+		const char *name = jobs[i].dir->get_name();
+
+		if(fds[i] == -2) {
+			handles[i] = open_dir(jobs[i].parent->fd, name, w->scan->follow);
+		} else if(fds[i] < 0) {
+			errno = -fds[i];
+			handles[i] = 0;
+		} else {
+			handles[i] = wrap_dir(fds[i]);
+		}
+
+		if(!handles[i]) {
+			fprintf(stderr, "failed to open dir: %s: %s\n", name, strerror(errno));
+		}
+	}
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof *st);
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_size = stx->stx_size;
+	st->st_atime = stx->stx_atime.tv_sec;
+	st->st_mtime = stx->stx_mtime.tv_sec;
+	st->st_ctime = stx->stx_ctime.tv_sec;
+}
+#endif	// HAVE_IO_URING
@@ -0,0 +1,114 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+class Dir;
+class File;
+
+/* number of worker threads used by build_tree, and by the other passes over
+ * the whole tree: calc_tree_stats and Dir::layout (0 means one per online cpu)
+ */
+void set_scan_threads(int num);
+int get_scan_threads();
+
+/* In eager mode (the default) build_tree stats every entry as it goes. In lazy
+ * mode it only builds the hierarchy, using the entry types from readdir, and
+ * file metadata is filled in later by fill_metadata or stat_file.
+ */
+enum {
+	SCAN_META_EAGER,
+	SCAN_META_LAZY
+};
+
+void set_scan_metadata(int mode);
+int get_scan_metadata();
+
+/* With the io_uring backend, the stats of each directory and the opens of
+ * queued directories are submitted in large batches. If io_uring isn't
+ * available at runtime, the scanner falls back to plain syscalls.
+ */
+enum {
+	SCAN_BACKEND_POSIX,
+	SCAN_BACKEND_URING
+};
+
+void set_scan_backend(int backend);
+int get_scan_backend();
+
+/* depth budget: directories more than this many levels below the root of a
+ * scan are created as unexpanded stubs, to be scanned later with scan_async
+ * (0 means no limit, the default)
+ */
+void set_scan_depth(int depth);
+int get_scan_depth();
+
+/* What scans go into, set before starting any:
+ * - in one-filesystem mode, directories on another device than the one a
+ *   scan started at (mount points) are left as unexpanded stubs, which can
+ *   still be expanded on their own
+ * - symlinks are not followed by default. When they are, they're taken for
+ *   whatever they point to, and broken ones are kept as links.
+ * - a directory already in the tree is never read again by another path, it
+ *   stays an unexpanded stub, which stops loops through symlinks or bind mounts
+ * - entries whose names match an exclude glob are left out altogether
+ * The stubs left by the first and the third are marked as skipped (see
+ * Dir::set_skipped) before the scan hands them out. Expanding one with
+ * scan_async reads it regardless, but not the ones under it.
+ */
+void set_scan_one_fs(bool one_fs);
+bool get_scan_one_fs();
+
+void set_scan_follow_links(bool follow);
+bool get_scan_follow_links();
+
+void add_scan_exclude(const char *glob);
+void clear_scan_excludes();
+
+/* stats all files in the tree which don't have their metadata yet. Background
+ * scans in lazy mode do this on their own once their nodes are attached.
+ */
+bool fill_metadata(Dir *tree);
+
+/* stats a single file of the tree on demand. On failure the file is marked
+ * (see File::set_stat_failed), for callers not to try again.
+ */
+bool stat_file(File *file);
+
+/* brings a tree, typically one loaded from the scan cache, up to date with the
+ * filesystem, reading again only the directories whose mtime changed since
+ * they were last read. refresh_tree does it in place, start_refresh in the
+ * background, with the changes applied by apply_scan_results.
+ */
+bool refresh_tree(Dir *tree);
+bool start_refresh(Dir *tree);
+
+/* starts scanning the filesystem in the background, filling the tree as
+ * apply_scan_results is called. Fails immediately if dirname can't be opened.
+ */
+bool start_scan(Dir *tree, const char *dirname);
+
+/* scans the contents of an unexpanded directory on a background thread. The
+ * nodes it finds are not added to the tree until apply_scan_results is
+ * called, by whichever thread owns the tree.
+ */
+bool scan_async(Dir *dir);
+// returns true if anything was added to the tree
+bool apply_scan_results();
+/* registers a function for apply_scan_results to call with every directory it
+ * adds to the tree, with the tree locked
+ */
+void add_scan_attach_func(void (*func)(Dir*));
+// true while background scans are queued, running, or have results pending
+bool scan_pending();
+
+// total number of directory entries read so far, for progress reports
+long get_scan_count();
+
+/* computes the aggregates of a directory and everything below it from
+ * scratch (see DirStats in fstree.h), splitting the subtrees between the
+ * scan threads, and updates those of its ancestors. Scans do it on their own
+ * for whatever they build or change. The caller must hold the tree lock if
+ * other threads are using the tree.
+ */
+void calc_tree_stats(Dir *dir);
+
+#endif	// SCAN_H_
@@ -0,0 +1,534 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <vector>
+#include "snapshot.h"
+#include "fstree.h"
+#include "scan.h"
+
+using namespace std;
+
+#define SNAP_MAGIC		"FSNAVSNP"
+#define SNAP_VERSION	3
+#define SNAP_BYTE_ORDER	0x01020304
+
+enum {
+	SECT_NODES,
+	SECT_STRTAB,
+	SECT_SIZE,
+	SECT_ATIME,		// in the order of ATIME, MTIME, CTIME
+	SECT_MTIME,
+	SECT_CTIME,
+	SECT_MODE,
+	SECT_UID,
+	SECT_GID,
+	SECT_NLINK,
+	SECT_DIR_STATS,
+
+	NUM_SECTIONS
+};
+
+struct SnapSection {
+	uint64_t offs, size;
+};
+
+struct SnapHeader {
+	char magic[8];
+	uint32_t version, byte_order;
+	uint32_t num_nodes, reserved;
+	SnapSection sect[NUM_SECTIONS];
+};
+
+enum {
+	NODE_DIR		= 1,
+	NODE_EXPANDED	= 2,	// directories: read, not a stub
+	NODE_STAT		= 4,	// files: metadata valid
+	NODE_DUP_LINK	= 8,	// files: another link to an inode counted elsewhere
+	NODE_SKIPPED	= 16	// directories: a stub left by the scan policy
+};
+
+struct SnapNode {
+	uint32_t name;		// offset in the string table
+	uint32_t parent;
+	uint32_t flags;
+	uint32_t children;	// index of the first child
+	uint32_t num_subdirs, num_files;
+};
+
+// aggregates of a directory, as it had them when the snapshot was taken
+struct SnapStats {
+	uint64_t size, largest;
+	int64_t newest;
+	uint32_t num_files, num_dirs;
+};
+
+#define ALIGN8(x)	(((x) + 7) & ~(uint64_t)7)
+
+Snapshot::Snapshot()
+{
+	map = 0;
+	map_size = 0;
+	num_nodes = 0;
+}
+
+Snapshot::~Snapshot()
+{
+	close();
+}
+
+bool Snapshot::open(const char *fname)
+{
+	int fd;
+	struct stat st;
+
+	close();
+
+	if((fd = ::open(fname, O_RDONLY)) == -1) {
+		fprintf(stderr, "failed to open snapshot: %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+	if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(SnapHeader)) {
+		fprintf(stderr, "not a tree snapshot: %s\n", fname);
+		::close(fd);
+		return false;
+	}
+
+	void *data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(data == MAP_FAILED) {
+		fprintf(stderr, "failed to map snapshot: %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+	map = data;
+	map_size = st.st_size;
+	hdr = (const SnapHeader*)data;
+
+	if(memcmp(hdr->magic, SNAP_MAGIC, sizeof hdr->magic) != 0) {
+		fprintf(stderr, "not a tree snapshot: %s\n", fname);
+		close();
+		return false;
+	}
+	if(hdr->version != SNAP_VERSION || hdr->byte_order != SNAP_BYTE_ORDER) {
+		fprintf(stderr, "snapshot from another version of fsnav, or a machine of different byte order: %s\n", fname);
+		close();
+		return false;
+	}
+
+	// only the layout is checked here, the contents are checked as they're used
+	static const int elem_size[] = {sizeof(SnapNode), 0, 8, 8, 8, 8, 4, 4, 4, 4, sizeof(SnapStats)};
+
+	for(int i=0; i<NUM_SECTIONS; i++) {
+		const SnapSection *sect = hdr->sect + i;
+		if(sect->offs % 8 || sect->offs > map_size || map_size - sect->offs < sect->size ||
+				sect->size / (elem_size[i] ? elem_size[i] : 1) < (elem_size[i] ? hdr->num_nodes : 1)) {
+			fprintf(stderr, "corrupt snapshot: %s\n", fname);
+			close();
+			return false;
+		}
+	}
+
+	const char *base = (const char*)data;
+	num_nodes = hdr->num_nodes;
+	nodes = (const SnapNode*)(base + hdr->sect[SECT_NODES].offs);
+	strtab = base + hdr->sect[SECT_STRTAB].offs;
+	strtab_size = hdr->sect[SECT_STRTAB].size;
+	size_col = (const uint64_t*)(base + hdr->sect[SECT_SIZE].offs);
+	for(int i=0; i<3; i++) {
+		time_col[i] = (const int64_t*)(base + hdr->sect[SECT_ATIME + i].offs);
+	}
+	mode_col = (const uint32_t*)(base + hdr->sect[SECT_MODE].offs);
+	uid_col = (const uint32_t*)(base + hdr->sect[SECT_UID].offs);
+	gid_col = (const uint32_t*)(base + hdr->sect[SECT_GID].offs);
+	nlink_col = (const uint32_t*)(base + hdr->sect[SECT_NLINK].offs);
+	stats_col = (const SnapStats*)(base + hdr->sect[SECT_DIR_STATS].offs);
+
+	if(!num_nodes || strtab[strtab_size - 1] != 0) {
+		fprintf(stderr, "corrupt snapshot: %s\n", fname);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void Snapshot::close()
+{
+	if(map) {
+		munmap(map, map_size);
+		map = 0;
+	}
+	num_nodes = 0;
+	stubs.clear();
+}
+
+uint32_t Snapshot::get_num_nodes() const
+{
+	return num_nodes;
+}
+
+const char *Snapshot::get_name(uint32_t idx) const
+{
+	if(idx >= num_nodes || nodes[idx].name >= strtab_size) {
+		return "";
+	}
+	return strtab + nodes[idx].name;
+}
+
+bool Snapshot::is_dir(uint32_t idx) const
+{
+	return idx < num_nodes && (nodes[idx].flags & NODE_DIR);
+}
+
+uint32_t Snapshot::get_parent(uint32_t idx) const
+{
+	return idx < num_nodes ? nodes[idx].parent : 0;
+}
+
+// returns the node of a directory if its child range is valid, 0 otherwise
+const SnapNode *Snapshot::get_dir_node(uint32_t idx) const
+{
+	if(idx >= num_nodes) {
+		return 0;
+	}
+	const SnapNode *node = nodes + idx;
+	if(!(node->flags & NODE_DIR) || node->children <= idx ||
+			(uint64_t)node->children + node->num_subdirs + node->num_files > num_nodes) {
+		return 0;
+	}
+	return node;
+}
+
+uint32_t Snapshot::get_first_child(uint32_t idx) const
+{
+	const SnapNode *node = get_dir_node(idx);
+	return node ? node->children : 0;
+}
+
+uint32_t Snapshot::get_num_subdirs(uint32_t idx) const
+{
+	const SnapNode *node = get_dir_node(idx);
+	return node ? node->num_subdirs : 0;
+}
+
+uint32_t Snapshot::get_num_files(uint32_t idx) const
+{
+	const SnapNode *node = get_dir_node(idx);
+	return node ? node->num_files : 0;
+}
+
+bool Snapshot::is_expanded(uint32_t idx) const
+{
+	return idx < num_nodes && (nodes[idx].flags & NODE_EXPANDED);
+}
+
+bool Snapshot::is_skipped(uint32_t idx) const
+{
+	return idx < num_nodes && (nodes[idx].flags & NODE_SKIPPED);
+}
+
+bool Snapshot::have_stat(uint32_t idx) const
+{
+	return idx < num_nodes && (nodes[idx].flags & NODE_STAT);
+}
+
+bool Snapshot::is_dup_link(uint32_t idx) const
+{
+	return idx < num_nodes && (nodes[idx].flags & NODE_DUP_LINK);
+}
+
+uint64_t Snapshot::get_size(uint32_t idx) const
+{
+	return idx < num_nodes ? size_col[idx] : 0;
+}
+
+unsigned int Snapshot::get_mode(uint32_t idx) const
+{
+	return idx < num_nodes ? mode_col[idx] : 0;
+}
+
+unsigned int Snapshot::get_uid(uint32_t idx) const
+{
+	return idx < num_nodes ? uid_col[idx] : 0;
+}
+
+unsigned int Snapshot::get_gid(uint32_t idx) const
+{
+	return idx < num_nodes ? gid_col[idx] : 0;
+}
+
+unsigned int Snapshot::get_links(uint32_t idx) const
+{
+	return idx < num_nodes ? nlink_col[idx] : 0;
+}
+
+int64_t Snapshot::get_time(uint32_t idx, int which) const
+{
+	return idx < num_nodes ? time_col[which][idx] : 0;
+}
+
+DirStats Snapshot::get_dir_stats(uint32_t idx) const
+{
+	DirStats st;
+	memset(&st, 0, sizeof st);
+	if(is_dir(idx)) {
+		const SnapStats *ss = stats_col + idx;
+		st.size = ss->size;
+		st.largest = ss->largest;
+		st.newest = ss->newest;
+		st.num_files = ss->num_files;
+		st.num_dirs = ss->num_dirs;
+	}
+	return st;
+}
+
+Dir *Snapshot::create_tree(int depth)
+{
+	if(!map) {
+		return 0;
+	}
+
+	Dir *root = new Dir;
+	root->set_name(get_name(0));
+	fill_dir(root, 0, depth);
+	calc_tree_stats(root);
+	return root;
+}
+
+bool Snapshot::expand(Dir *stub, int depth)
+{
+	std::map<const Dir*, uint32_t>::iterator it = stubs.find(stub);
+	if(it == stubs.end()) {
+		return false;
+	}
+	uint32_t idx = it->second;
+	stubs.erase(it);
+
+	lock_tree();
+	stub->set_expanded(true);
+	fill_dir(stub, idx, depth);
+	calc_tree_stats(stub);
+	unlock_tree();
+	return true;
+}
+
+/* creates the children of a directory, and theirs in turn, down to depth
+ * levels below it (0 for no limit).
+ */
+void Snapshot::fill_dir(Dir *dir, uint32_t idx, int depth)
+{
+	dir->set_mtime(get_time(idx, MTIME));
+
+	if(!is_expanded(idx)) {
+		dir->set_expanded(false);	// it was a stub when the snapshot was taken
+		dir->set_skipped(is_skipped(idx));
+		return;
+	}
+
+	uint32_t first = get_first_child(idx);
+	uint32_t num_subdirs = get_num_subdirs(idx);
+	uint32_t num_files = get_num_files(idx);
+
+	for(uint32_t i=0; i<num_subdirs; i++) {
+		uint32_t sub = first + i;
+
+		Dir *subdir = new_dir(dir->get_arena());
+		subdir->set_name(get_name(sub));
+		dir->add_subdir(subdir);
+
+		if(depth == 1) {
+			subdir->set_expanded(false);
+			stubs[subdir] = sub;
+			subdir->set_stats(get_dir_stats(sub));
+		} else {
+			fill_dir(subdir, sub, depth ? depth - 1 : 0);
+		}
+	}
+
+	for(uint32_t i=0; i<num_files; i++) {
+		uint32_t fidx = first + num_subdirs + i;
+
+		File *file = new_file(dir->get_arena());
+		file->set_name(get_name(fidx));
+		file->set_links(get_links(fidx));
+
+		if(have_stat(fidx)) {
+			// no inode numbers in snapshots, links are as they were when it was taken
+			struct stat st;
+			memset(&st, 0, sizeof st);
+			st.st_nlink = get_links(fidx);
+			st.st_mode = get_mode(fidx);
+			st.st_uid = get_uid(fidx);
+			st.st_gid = get_gid(fidx);
+			st.st_size = get_size(fidx);
+			st.st_atime = get_time(fidx, ATIME);
+			st.st_mtime = get_time(fidx, MTIME);
+			st.st_ctime = get_time(fidx, CTIME);
+			file->set_stat(&st);
+			file->set_dup_link(is_dup_link(fidx));
+		} else {
+			file->set_mode(get_mode(fidx));
+		}
+		dir->add_file(file);
+	}
+}
+
+bool write_snapshot(const Dir *tree, const char *fname)
+{
+	vector<const FSNode*> queue;
+	vector<SnapNode> nodes;
+	vector<char> strtab;
+	vector<uint64_t> sizes;
+	vector<int64_t> times[3];
+	vector<uint32_t> modes, uids, gids, nlinks;
+	vector<SnapStats> stats;
+	// names are interned by the tree, so equal names share a pointer, and are stored once
+	std::map<const char*, uint32_t> name_offs;
+
+	queue.push_back(tree);
+	nodes.resize(1);
+	nodes[0].parent = 0;
+
+	// nodes are numbered in the order they're queued, which makes it breadth first
+	for(size_t i=0; i<queue.size(); i++) {
+		const FSNode *fsnode = queue[i];
+		SnapNode *node = &nodes[i];
+		const char *name = fsnode->get_name();
+
+		std::map<const char*, uint32_t>::iterator it = name_offs.find(name);
+		if(it != name_offs.end()) {
+			node->name = it->second;
+		} else {
+			node->name = strtab.size();
+			name_offs[name] = node->name;
+			strtab.insert(strtab.end(), name, name + strlen(name) + 1);
+		}
+
+		node->children = node->num_subdirs = node->num_files = 0;
+		uint64_t size = 0;
+		int64_t tm[3] = {0, 0, 0};
+		uint32_t mode = 0, uid = 0, gid = 0, nlink = 0;
+		SnapStats ss;
+		memset(&ss, 0, sizeof ss);
+
+		const Dir *dir = fsnode->is_dir() ? (const Dir*)fsnode : 0;
+		if(dir) {
+			node->flags = NODE_DIR | (dir->is_expanded() ? NODE_EXPANDED : 0) |
+					(dir->is_skipped() ? NODE_SKIPPED : 0);
+			node->children = queue.size();
+			node->num_subdirs = dir->get_num_subdirs();
+			node->num_files = dir->get_num_files();
+			tm[MTIME] = dir->get_mtime();
+
+			// kept up to date by the tree, stubs included, so they're just copied
+			DirStats st = dir->get_stats();
+			ss.size = st.size;
+			ss.largest = st.largest;
+			ss.newest = st.newest;
+			ss.num_files = st.num_files;
+			ss.num_dirs = st.num_dirs;
+
+			uint32_t num_children = node->num_subdirs + node->num_files;
+			for(uint32_t j=0; j<node->num_subdirs; j++) {
+				queue.push_back(dir->get_subdir(j));
+			}
+			for(uint32_t j=0; j<node->num_files; j++) {
+				queue.push_back(dir->get_file(j));
+			}
+
+			SnapNode child;
+			memset(&child, 0, sizeof child);
+			child.parent = i;
+			nodes.insert(nodes.end(), num_children, child);	// may move node
+
+		} else {
+			const File *file = (const File*)fsnode;
+			node->flags = file->have_stat() ? NODE_STAT : 0;
+			if(file->is_dup_link()) {
+				node->flags |= NODE_DUP_LINK;
+			}
+			size = file->get_size();
+			mode = file->get_mode();
+			uid = file->get_uid();
+			gid = file->get_gid();
+			nlink = file->get_links();
+			for(int j=0; j<3; j++) {
+				tm[j] = file->get_time(j);
+			}
+		}
+
+		sizes.push_back(size);
+		for(int j=0; j<3; j++) {
+			times[j].push_back(tm[j]);
+		}
+		modes.push_back(mode);
+		uids.push_back(uid);
+		gids.push_back(gid);
+		nlinks.push_back(nlink);
+		stats.push_back(ss);
+	}
+
+	if(queue.size() > UINT32_MAX || strtab.size() > UINT32_MAX) {
+		fprintf(stderr, "tree too large for a snapshot\n");
+		return false;
+	}
+
+	const void *sect_data[NUM_SECTIONS] = {
+		&nodes[0], &strtab[0], &sizes[0], &times[0][0], &times[1][0], &times[2][0],
+		&modes[0], &uids[0], &gids[0], &nlinks[0], &stats[0]
+	};
+	size_t num = queue.size();
+	uint64_t sect_size[NUM_SECTIONS] = {
+		num * sizeof(SnapNode), strtab.size(), num * 8, num * 8, num * 8, num * 8,
+		num * 4, num * 4, num * 4, num * 4, num * sizeof(SnapStats)
+	};
+
+	SnapHeader hdr;
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof hdr.magic);
+	hdr.version = SNAP_VERSION;
+	hdr.byte_order = SNAP_BYTE_ORDER;
+	hdr.num_nodes = num;
+
+	uint64_t offs = ALIGN8(sizeof hdr);
+	for(int i=0; i<NUM_SECTIONS; i++) {
+		hdr.sect[i].offs = offs;
+		hdr.sect[i].size = sect_size[i];
+		offs = ALIGN8(offs + sect_size[i]);
+	}
+
+	// written to a temporary file first, so that a crash never leaves a partial snapshot
+	char tmpname[PATH_MAX + 64];
+	snprintf(tmpname, sizeof tmpname, "%s.tmp", fname);
+
+	FILE *fp = fopen(tmpname, "wb");
+	if(!fp) {
+		fprintf(stderr, "failed to write snapshot: %s: %s\n", tmpname, strerror(errno));
+		return false;
+	}
+
+	static const char zeros[8] = {0};
+	bool ok = fwrite(&hdr, sizeof hdr, 1, fp) == 1;
+	uint64_t pos = sizeof hdr;
+
+	for(int i=0; ok && i<NUM_SECTIONS; i++) {
+		if(fwrite(zeros, 1, hdr.sect[i].offs - pos, fp) != hdr.sect[i].offs - pos ||
+				fwrite(sect_data[i], 1, sect_size[i], fp) != sect_size[i]) {
+			ok = false;
+		}
+		pos = hdr.sect[i].offs + sect_size[i];
+	}
+
+	if(fclose(fp) != 0) {
+		ok = false;
+	}
+	if(!ok || rename(tmpname, fname) == -1) {
+		fprintf(stderr, "failed to write snapshot: %s: %s\n", fname, strerror(errno));
+		remove(tmpname);
+		return false;
+	}
+	return true;
+}
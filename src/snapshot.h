@@ -0,0 +1,95 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdint.h>
+#include <map>
+
+class Dir;
+struct DirStats;
+
+/* A tree snapshot is a flat image of a tree without any pointers: nodes are
+ * numbered breadth first, so the children of every directory are a range of
+ * node numbers, names live in a shared string table, and file metadata is
+ * kept in columns indexed by node number. The file is mapped and traversed
+ * in place, so opening even a huge snapshot costs next to nothing, and only
+ * the pages actually visited are ever read.
+ *
+ * Fields are fixed size, and sections are 8 byte aligned, so snapshots can
+ * be moved between machines of the same byte order.
+ */
+
+struct SnapHeader;
+struct SnapNode;
+struct SnapStats;
+
+class Snapshot {
+private:
+	void *map;
+	size_t map_size;
+
+	const SnapHeader *hdr;
+	const SnapNode *nodes;
+	uint32_t num_nodes;
+	const char *strtab;
+	uint64_t strtab_size;
+
+	const uint64_t *size_col;
+	const int64_t *time_col[3];
+	const uint32_t *mode_col, *uid_col, *gid_col, *nlink_col;
+	const SnapStats *stats_col;
+
+	std::map<const Dir*, uint32_t> stubs;	// left unexpanded by create_tree or expand
+
+	const SnapNode *get_dir_node(uint32_t idx) const;
+	void fill_dir(Dir *dir, uint32_t idx, int depth);
+
+public:
+	Snapshot();
+	~Snapshot();
+
+	bool open(const char *fname);
+	void close();
+
+	/* Node 0 is the root. Every accessor checks its arguments against the
+	 * file, so a corrupt snapshot reads as a smaller tree instead of
+	 * crashing. Children always come after their directory, so any walk
+	 * down the tree terminates.
+	 */
+	uint32_t get_num_nodes() const;
+
+	const char *get_name(uint32_t idx) const;
+	bool is_dir(uint32_t idx) const;
+	uint32_t get_parent(uint32_t idx) const;
+
+	// subdirectories first, then files
+	uint32_t get_first_child(uint32_t idx) const;
+	uint32_t get_num_subdirs(uint32_t idx) const;
+	uint32_t get_num_files(uint32_t idx) const;
+
+	bool is_expanded(uint32_t idx) const;	// directories
+	bool is_skipped(uint32_t idx) const;	// directories, see Dir::set_skipped
+	bool have_stat(uint32_t idx) const;		// files
+	bool is_dup_link(uint32_t idx) const;	// files, see File::set_stat
+
+	uint64_t get_size(uint32_t idx) const;
+	unsigned int get_mode(uint32_t idx) const;
+	unsigned int get_uid(uint32_t idx) const;
+	unsigned int get_gid(uint32_t idx) const;
+	unsigned int get_links(uint32_t idx) const;
+	// for directories only the mtime is kept, in nsec
+	int64_t get_time(uint32_t idx, int which) const;
+	// aggregates of everything under a directory, stored with it
+	DirStats get_dir_stats(uint32_t idx) const;
+
+	/* creates the nodes of the tree, down to depth levels below the root (0
+	 * for all of it). Directories further down are left as unexpanded stubs,
+	 * which are filled in on demand by expand. Stubs still get the aggregates
+	 * of everything under them, which the snapshot stores for every directory.
+	 */
+	Dir *create_tree(int depth);
+	bool expand(Dir *stub, int depth);
+};
+
+bool write_snapshot(const Dir *tree, const char *fname);
+
+#endif	// SNAPSHOT_H_
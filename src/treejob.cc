@@ -0,0 +1,73 @@
+#include <pthread.h>
+#include "treejob.h"
+#include "fstree.h"
+
+using namespace std;
+
+struct TreeJob {
+	const vector<Dir*> *dirs;
+	void (*func)(Dir*);
+	volatile int next;
+};
+
+static void *job_thread(void *arg);
+static void run_job(TreeJob *job);
+
+void split_tree(Dir *dir, int nthreads, vector<Dir*> *upper, vector<Dir*> *subtrees)
+{
+	upper->clear();
+	subtrees->clear();
+	subtrees->push_back(dir);
+
+	while(nthreads > 1 && !subtrees->empty() && (int)subtrees->size() < nthreads * TREEJOB_SPLIT) {
+		upper->insert(upper->end(), subtrees->begin(), subtrees->end());
+
+		vector<Dir*> next;
+		for(size_t i=0; i<subtrees->size(); i++) {
+			Dir *sub = (*subtrees)[i];
+			int num_subdirs = sub->get_num_subdirs();
+			for(int j=0; j<num_subdirs; j++) {
+				next.push_back(sub->get_subdir(j));
+			}
+		}
+		subtrees->swap(next);
+	}
+}
+
+void run_subtrees(const vector<Dir*> &subtrees, void (*func)(Dir*), int nthreads)
+{
+	TreeJob job;
+	job.dirs = &subtrees;
+	job.func = func;
+	job.next = 0;
+
+	int num_workers = min(nthreads, (int)subtrees.size());
+	vector<pthread_t> threads(num_workers, 0);
+	for(int i=1; i<num_workers; i++) {
+		if(pthread_create(&threads[i], 0, job_thread, &job) != 0) {
+			threads[i] = 0;	// the others will make up for it
+		}
+	}
+
+	run_job(&job);
+
+	for(int i=1; i<num_workers; i++) {
+		if(threads[i]) {
+			pthread_join(threads[i], 0);
+		}
+	}
+}
+
+static void *job_thread(void *arg)
+{
+	run_job((TreeJob*)arg);
+	return 0;
+}
+
+static void run_job(TreeJob *job)
+{
+	int idx;
+	while((idx = __sync_fetch_and_add(&job->next, 1)) < (int)job->dirs->size()) {
+		job->func((*job->dirs)[idx]);
+	}
+}
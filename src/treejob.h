@@ -0,0 +1,29 @@
+#ifndef TREEJOB_H_
+#define TREEJOB_H_
+
+#include <vector>
+
+class Dir;
+
+/* Fork-join helpers for the passes over a whole tree which only look at a
+ * directory and its immediate children at a time: the aggregates, and the
+ * layout. The tree is split a few levels down, until there are TREEJOB_SPLIT
+ * subtrees per thread, so that a thread which finishes early can pick up
+ * another. The directories above the split are left to the caller, since
+ * they have to go after (bottom-up passes) or before (top-down passes) the
+ * subtrees.
+ */
+#define TREEJOB_SPLIT	8
+
+/* upper gets the directories above the split in breadth-first order, so each
+ * one comes after its parent, and subtrees the roots of the subtrees. With a
+ * single thread, the whole tree is one subtree.
+ */
+void split_tree(Dir *dir, int nthreads, std::vector<Dir*> *upper, std::vector<Dir*> *subtrees);
+
+/* calls func for each of the subtrees, on up to nthreads threads including
+ * the calling one, and returns once all of them are done
+ */
+void run_subtrees(const std::vector<Dir*> &subtrees, void (*func)(Dir*), int nthreads);
+
+#endif	// TREEJOB_H_
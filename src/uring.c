@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+	unsigned int entries;
+
+	/* submission queue */
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int sq_pending;	/* queued with uring_* but not yet submitted */
+
+	/* completion queue */
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned int reaped;		/* completions fetched so far */
+
+	void *sq_map, *cq_map;
+	size_t sq_map_size, cq_map_size, sqes_size;
+};
+
+#define load_acquire(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static struct io_uring_sqe *get_sqe(struct uring *ring);
+
+struct uring *uring_create(unsigned int entries)
+{
+	struct uring *ring;
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	if(!(ring = calloc(1, sizeof *ring))) {
+		return 0;
+	}
+
+	memset(&p, 0, sizeof p);
+	if((ring->fd = syscall(__NR_io_uring_setup, entries, &p)) == -1) {
+		free(ring);
+		return 0;
+	}
+	ring->entries = p.sq_entries;
+
+	ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(ring->cq_map_size > ring->sq_map_size) {
+			ring->sq_map_size = ring->cq_map_size;
+		}
+		ring->cq_map_size = ring->sq_map_size;
+	}
+
+	ring->sq_map = mmap(0, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sq_map == MAP_FAILED) {
+		goto err;
+	}
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(0, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cq_map == MAP_FAILED) {
+			ring->cq_map = 0;
+			goto err;
+		}
+	}
+
+	ring->sqes = mmap(0, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED) {
+		ring->sqes = 0;
+		goto err;
+	}
+
+	sq = ring->sq_map;
+	ring->sq_head = (unsigned int*)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int*)(sq + p.sq_off.array);
+
+	cq = ring->cq_map;
+	ring->cq_head = (unsigned int*)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	return ring;
+
+err:
+	uring_destroy(ring);
+	return 0;
+}
+
+void uring_destroy(struct uring *ring)
+{
+	int err = errno;
+
+	if(!ring) return;
+
+	/* the kernel would still write the results of whatever it took into the
+	 * caller's buffers, so it's given the chance to finish first. Callers who
+	 * care about those results reap them before this.
+	 */
+	if(ring->sq_head) {
+		unsigned long data;
+		int res;
+		while(uring_inflight(ring) > 0 && uring_wait(ring) != -1) {
+			while(uring_complete(ring, &data, &res));
+		}
+	}
+
+	if(ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if(ring->cq_map && ring->cq_map != ring->sq_map) {
+		munmap(ring->cq_map, ring->cq_map_size);
+	}
+	if(ring->sq_map && ring->sq_map != MAP_FAILED) {
+		munmap(ring->sq_map, ring->sq_map_size);
+	}
+	close(ring->fd);
+	free(ring);
+
+	errno = err;
+}
+
+int uring_space(struct uring *ring)
+{
+	unsigned int used = *ring->sq_tail + ring->sq_pending - load_acquire(ring->sq_head);
+	return (int)(ring->entries - used);
+}
+
+int uring_statx(struct uring *ring, int dirfd, const char *path, int flags,
+		unsigned int mask, struct statx *buf, unsigned long data)
+{
+	struct io_uring_sqe *sqe;
+
+	if(!(sqe = get_sqe(ring))) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = dirfd;
+	sqe->addr = (unsigned long)path;
+	sqe->len = mask;
+	sqe->off = (unsigned long)buf;
+	sqe->statx_flags = flags;
+	sqe->user_data = data;
+	return 0;
+}
+
+int uring_openat(struct uring *ring, int dirfd, const char *path, int flags,
+		unsigned long data)
+{
+	struct io_uring_sqe *sqe;
+
+	if(!(sqe = get_sqe(ring))) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = dirfd;
+	sqe->addr = (unsigned long)path;
+	sqe->len = 0;
+	sqe->open_flags = flags;
+	sqe->user_data = data;
+	return 0;
+}
+
+int uring_submit(struct uring *ring, unsigned int wait_nr)
+{
+	int res;
+	unsigned int count;
+	unsigned int flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+
+	/* make the new entries visible to the kernel, and submit those along with
+	 * any it didn't take the last time
+	 */
+	store_release(ring->sq_tail, *ring->sq_tail + ring->sq_pending);
+	ring->sq_pending = 0;
+	count = *ring->sq_tail - load_acquire(ring->sq_head);
+
+	do {
+		res = syscall(__NR_io_uring_enter, ring->fd, count, wait_nr, flags, 0, 0);
+	} while(res == -1 && errno == EINTR);
+
+	return res;
+}
+
+int uring_complete(struct uring *ring, unsigned long *data, int *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head = *ring->cq_head;
+
+	if(head == load_acquire(ring->cq_tail)) {
+		return 0;
+	}
+	cqe = ring->cqes + (head & *ring->cq_mask);
+	*data = cqe->user_data;
+	*res = cqe->res;
+	ring->reaped++;
+
+	store_release(ring->cq_head, head + 1);
+	return 1;
+}
+
+unsigned int uring_inflight(struct uring *ring)
+{
+	return load_acquire(ring->sq_head) - ring->reaped;
+}
+
+int uring_wait(struct uring *ring)
+{
+	int res;
+	do {
+		res = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+	} while(res == -1 && errno == EINTR);
+	return res;
+}
+
+static struct io_uring_sqe *get_sqe(struct uring *ring)
+{
+	unsigned int idx;
+	struct io_uring_sqe *sqe;
+
+	if(uring_space(ring) <= 0) {
+		return 0;
+	}
+
+	idx = (*ring->sq_tail + ring->sq_pending++) & *ring->sq_mask;
+	ring->sq_array[idx] = idx;
+
+	sqe = ring->sqes + idx;
+	memset(sqe, 0, sizeof *sqe);
+	return sqe;
+}
+
+#else	/* !HAVE_IO_URING */
+
+struct uring *uring_create(unsigned int entries)
+{
+	errno = ENOSYS;
+	return 0;
+}
+
+void uring_destroy(struct uring *ring)
+{
+}
+
+int uring_space(struct uring *ring)
+{
+	return 0;
+}
+
+int uring_statx(struct uring *ring, int dirfd, const char *path, int flags,
+		unsigned int mask, struct statx *buf, unsigned long data)
+{
+	return -1;
+}
+
+int uring_openat(struct uring *ring, int dirfd, const char *path, int flags,
+		unsigned long data)
+{
+	return -1;
+}
+
+int uring_submit(struct uring *ring, unsigned int wait_nr)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_complete(struct uring *ring, unsigned long *data, int *res)
+{
+	return 0;
+}
+
+unsigned int uring_inflight(struct uring *ring)
+{
+	return 0;
+}
+
+int uring_wait(struct uring *ring)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif	/* HAVE_IO_URING */
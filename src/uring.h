@@ -0,0 +1,55 @@
+#ifndef URING_H_
+#define URING_H_
+
+/* minimal io_uring wrapper, just enough to batch the scanner's syscalls
+ * without depending on liburing. When fsnav is built without HAVE_IO_URING,
+ * uring_create always fails, and callers fall back to plain syscalls.
+ */
+
+struct uring;
+struct statx;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns 0 and sets errno if io_uring isn't available (old kernel,
+ * disabled by sysctl or seccomp, or not compiled in)
+ */
+struct uring *uring_create(unsigned int entries);
+/* waits for the requests the kernel has taken to complete, discarding their
+ * results, before tearing the ring down
+ */
+void uring_destroy(struct uring *ring);
+
+/* number of submission slots which can be queued before the next submit */
+int uring_space(struct uring *ring);
+
+/* queue requests, these return -1 if the submission queue is full */
+int uring_statx(struct uring *ring, int dirfd, const char *path, int flags,
+		unsigned int mask, struct statx *buf, unsigned long data);
+int uring_openat(struct uring *ring, int dirfd, const char *path, int flags,
+		unsigned long data);
+
+/* submits everything queued so far, and waits for at least wait_nr
+ * completions. Returns the number submitted, or -1 on error.
+ */
+int uring_submit(struct uring *ring, unsigned int wait_nr);
+
+/* fetches the next completion if there is one, returns 0 if the completion
+ * queue is empty. res is the result of the syscall (-errno on failure).
+ */
+int uring_complete(struct uring *ring, unsigned long *data, int *res);
+
+/* number of requests taken by the kernel whose completions weren't fetched
+ * yet. Those still write into their buffers, even after a failed submit.
+ */
+unsigned int uring_inflight(struct uring *ring);
+/* waits for at least one completion, without submitting anything */
+int uring_wait(struct uring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* URING_H_ */
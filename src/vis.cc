@@ -13,7 +13,8 @@
 static void draw_cube(float sz);
 static const char *mode_str(unsigned int mode);
 
-extern unsigned int fonttt, fontrm, fonttt_sm;
+unsigned int fontrm, fonttt, fonttt_sm;
+unsigned int scope_tex;
 
 void draw_env()
 {
@@ -176,8 +177,6 @@ void draw_file_stats(const File *file)
 
 void draw_file_stats(const File *file, float mx, float my)
 {
-	extern unsigned int scope_tex;
-
 	glMatrixMode(GL_PROJECTION);
 	glPushMatrix();
 	glLoadIdentity();
@@ -288,6 +287,24 @@ void draw_file_stats(const File *file, float mx, float my)
 	glEnable(GL_DEPTH_TEST);
 }
 
+void draw_scan_progress(long num_entries, float rate)
+{
+	char buf[128];
+
+	sprintf(buf, "scanning: %ld entries (%.0f/sec)", num_entries, rate);
+
+	bind_font(fonttt_sm);
+
+	glPushAttrib(GL_ENABLE_BIT);
+	glDisable(GL_DEPTH_TEST);
+	set_text_mode(TEXT_MODE_2D);
+	set_text_pos(0.02, 0.04);
+	set_text_size(1.0);
+
+	print_string(buf);
+	glPopAttrib();
+}
+
 static const char *mode_str(unsigned int mode)
 {
 	static char str[10];
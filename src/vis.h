@@ -3,11 +3,16 @@
 
 #include "fstree.h"
 
+// fonts and textures loaded by main
+extern unsigned int fontrm, fonttt, fonttt_sm;
+extern unsigned int scope_tex;
+
 void draw_env();
 void draw_node(const FSNode *node);
 void draw_node_text(const FSNode *node);
 void draw_link(const Link *link);
 void draw_file_stats(const File *file);
 void draw_file_stats(const File *file, float mx, float my);
+void draw_scan_progress(long num_entries, float rate);
 
 #endif	// VIS_H_
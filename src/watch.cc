@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <vector>
+#include "watch.h"
+#include "fstree.h"
+#include "scan.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+
+#ifdef __linux__
+
+#define WATCH_MASK	\
+	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | \
+	 IN_ONLYDIR | IN_EXCL_UNLINK)
+
+#define READ_SIZE	16384
+
+static void read_events();
+static void handle_event(const struct inotify_event *ev);
+static void add_entry(Dir *dir, const char *name, bool isdir, unsigned int cookie);
+static void remove_entry(Dir *dir, const char *name, bool isdir, unsigned int cookie);
+static void node_freed(const FSNode *node);
+static Dir *find_watch(int wd);
+static void unwatch(Dir *dir);
+
+static int ifd = -1;
+
+// the scanner threads add watches, so these are protected by watch_lock
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static map<int, Dir*> watch_dirs;	// by watch descriptor
+static map<Dir*, int> dir_watches;
+static bool warned_limit;
+
+static vector<char> evbuf;	// events read, but not applied yet
+
+// changes collected while applying a batch of events
+static set<Dir*> changed_dirs;
+static set<File*> changed_files;
+static set<Dir*> new_dirs;
+static map<unsigned int, FSNode*> moved_nodes;	// moved out of their directory, by cookie
+
+bool init_watch()
+{
+	if((ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		fprintf(stderr, "failed to initialize inotify: %s\n", strerror(errno));
+		return false;
+	}
+	add_node_free_func(node_freed);
+	return true;
+}
+
+void shutdown_watch()
+{
+	if(ifd != -1) {
+		close(ifd);
+		ifd = -1;
+	}
+
+	pthread_mutex_lock(&watch_lock);
+	watch_dirs.clear();
+	dir_watches.clear();
+	pthread_mutex_unlock(&watch_lock);
+
+	evbuf.clear();
+}
+
+/* The scanner has the directory open already, so the watch is added through
+ * its fd, which saves walking the whole path again.
+ */
+bool watch_dir(Dir *dir, int fd)
+{
+	char path[64];
+
+	if(ifd == -1) {
+		return false;
+	}
+
+	sprintf(path, "/proc/self/fd/%d", fd);
+
+	int wd = inotify_add_watch(ifd, path, WATCH_MASK);
+	if(wd == -1) {
+		if(errno == ENOSPC && !warned_limit) {
+			fprintf(stderr, "inotify watch limit reached, further changes won't be tracked "
+					"(see /proc/sys/fs/inotify/max_user_watches)\n");
+			warned_limit = true;
+		}
+		return false;
+	}
+
+	pthread_mutex_lock(&watch_lock);
+	watch_dirs[wd] = dir;
+	dir_watches[dir] = wd;
+	pthread_mutex_unlock(&watch_lock);
+	return true;
+}
+
+bool apply_watch_events()
+{
+	if(ifd == -1) {
+		return false;
+	}
+
+	read_events();
+	if(evbuf.empty() || scan_pending()) {
+		return false;
+	}
+
+	lock_tree();
+
+	size_t offs = 0;
+	while(offs < evbuf.size()) {
+		struct inotify_event *ev = (struct inotify_event*)&evbuf[offs];
+		handle_event(ev);
+		offs += sizeof *ev + ev->len;
+	}
+	evbuf.clear();
+
+	// whatever was moved out of the tree isn't coming back
+	map<unsigned int, FSNode*>::iterator mit = moved_nodes.begin();
+	while(mit != moved_nodes.end()) {
+		free_node(mit->second);
+		mit++;
+	}
+	moved_nodes.clear();
+
+	unlock_tree();
+
+	bool changed = !changed_dirs.empty() || !changed_files.empty();
+
+	vector<Dir*> stats_dirs(changed_dirs.begin(), changed_dirs.end());
+
+	set<File*>::iterator fit = changed_files.begin();
+	while(fit != changed_files.end()) {
+		File *file = *fit++;
+		stat_file(file);
+		stats_dirs.push_back((Dir*)file->get_parent());
+	}
+	changed_files.clear();
+
+	lock_tree();
+	take_relinked_dirs(&stats_dirs);
+	update_stats(stats_dirs);
+	unlock_tree();
+
+	changed_dirs.clear();
+
+	// started last, so that nothing they scan has been freed by a later event
+	set<Dir*>::iterator dit = new_dirs.begin();
+	while(dit != new_dirs.end()) {
+		scan_async(*dit++);
+	}
+	new_dirs.clear();
+
+	return changed;
+}
+
+static void read_events()
+{
+	for(;;) {
+		size_t prev_size = evbuf.size();
+		evbuf.resize(prev_size + READ_SIZE);
+
+		ssize_t sz = read(ifd, &evbuf[prev_size], READ_SIZE);
+		evbuf.resize(prev_size + (sz > 0 ? sz : 0));
+
+		if(sz <= 0) {
+			if(sz == -1 && errno != EAGAIN && errno != EINTR) {
+				fprintf(stderr, "failed to read inotify events: %s\n", strerror(errno));
+			}
+			break;
+		}
+	}
+}
+
+static void handle_event(const struct inotify_event *ev)
+{
+	if(ev->mask & IN_Q_OVERFLOW) {
+		fprintf(stderr, "inotify event queue overflow, some changes were missed\n");
+		return;
+	}
+
+	if(ev->mask & IN_IGNORED) {
+		// the directory is gone, or unmounted
+		pthread_mutex_lock(&watch_lock);
+		map<int, Dir*>::iterator it = watch_dirs.find(ev->wd);
+		if(it != watch_dirs.end()) {
+			dir_watches.erase(it->second);
+			watch_dirs.erase(it);
+		}
+		pthread_mutex_unlock(&watch_lock);
+		return;
+	}
+
+	Dir *dir = find_watch(ev->wd);
+	if(!dir || !ev->len) {
+		return;	// events about the watched directory itself are reported by its parent
+	}
+
+	bool isdir = ev->mask & IN_ISDIR;
+
+	if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		add_entry(dir, ev->name, isdir, (ev->mask & IN_MOVED_TO) ? ev->cookie : 0);
+
+	} else if(ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		remove_entry(dir, ev->name, isdir, (ev->mask & IN_MOVED_FROM) ? ev->cookie : 0);
+
+	} else if(!isdir) {
+		// modified, or its attributes changed
+		File *file = dir->find_file(ev->name);
+		if(file) {
+			changed_files.insert(file);
+		}
+	}
+}
+
+static void add_entry(Dir *dir, const char *name, bool isdir, unsigned int cookie)
+{
+	FSNode *node = 0;
+
+	if(cookie) {
+		map<unsigned int, FSNode*>::iterator it = moved_nodes.find(cookie);
+		if(it != moved_nodes.end()) {
+			node = it->second;
+			moved_nodes.erase(it);
+		}
+	}
+
+	Dir *prev_dir = dir->find_subdir(name);
+	File *prev_file = dir->find_file(name);
+
+	if(!node) {
+		// already there, if the scan which read the directory raced with the event
+		if(isdir && prev_dir) {
+			return;
+		}
+		if(!isdir && prev_file) {
+			changed_files.insert(prev_file);
+			return;
+		}
+	}
+
+	// anything else with the same name was replaced
+	if(prev_dir) {
+		dir->remove_subdir(prev_dir);
+		free_node(prev_dir);
+	}
+	if(prev_file) {
+		dir->remove_file(prev_file);
+		free_node(prev_file);
+	}
+
+	if(node) {
+		node->set_name(name);
+
+		if(node->is_dir()) {
+			dir->add_subdir((Dir*)node);
+		} else {
+			dir->add_file((File*)node);
+			changed_files.insert((File*)node);
+		}
+
+	} else if(isdir) {
+		Dir *subdir = new_dir(dir->get_arena());
+		subdir->set_name(name);
+		subdir->set_expanded(false);
+		dir->add_subdir(subdir);
+		new_dirs.insert(subdir);
+
+	} else {
+		File *file = new_file(dir->get_arena());
+		file->set_name(name);
+		dir->add_file(file);
+		changed_files.insert(file);
+	}
+
+	changed_dirs.insert(dir);
+}
+
+static void remove_entry(Dir *dir, const char *name, bool isdir, unsigned int cookie)
+{
+	FSNode *node;
+
+	if(isdir) {
+		Dir *subdir = dir->find_subdir(name);
+		if(!subdir) {
+			return;
+		}
+		dir->remove_subdir(subdir);
+		node = subdir;
+	} else {
+		File *file = dir->find_file(name);
+		if(!file) {
+			return;
+		}
+		dir->remove_file(file);
+		node = file;
+	}
+
+	changed_dirs.insert(dir);
+
+	if(cookie) {
+		moved_nodes[cookie] = node;	// it may turn up in a watched directory
+	} else {
+		free_node(node);
+	}
+}
+
+/* drops every reference to a node which is about to be freed, by us or by a
+ * background scan which found it gone. It's already half destroyed, so only
+ * its address is used.
+ */
+static void node_freed(const FSNode *node)
+{
+	Dir *dir = (Dir*)node;
+
+	changed_dirs.erase(dir);
+	new_dirs.erase(dir);
+	changed_files.erase((File*)node);
+
+	if(ifd != -1) {
+		unwatch(dir);
+	}
+}
+
+static Dir *find_watch(int wd)
+{
+	pthread_mutex_lock(&watch_lock);
+	map<int, Dir*>::iterator it = watch_dirs.find(wd);
+	Dir *dir = it == watch_dirs.end() ? 0 : it->second;
+	pthread_mutex_unlock(&watch_lock);
+	return dir;
+}
+
+static void unwatch(Dir *dir)
+{
+	pthread_mutex_lock(&watch_lock);
+	map<Dir*, int>::iterator it = dir_watches.find(dir);
+	if(it != dir_watches.end()) {
+		int wd = it->second;
+		dir_watches.erase(it);
+
+		// the same directory might be in the tree twice, through a bind mount
+		map<int, Dir*>::iterator wit = watch_dirs.find(wd);
+		if(wit != watch_dirs.end() && wit->second == dir) {
+			watch_dirs.erase(wit);
+			inotify_rm_watch(ifd, wd);
+		}
+	}
+	pthread_mutex_unlock(&watch_lock);
+}
+
+#else	// !__linux__
+
+bool init_watch()
+{
+	fprintf(stderr, "live updates are only supported on linux\n");
+	return false;
+}
+
+void shutdown_watch()
+{
+}
+
+bool watch_dir(Dir *dir, int fd)
+{
+	return false;
+}
+
+bool apply_watch_events()
+{
+	return false;
+}
+
+#endif	// __linux__
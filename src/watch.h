@@ -0,0 +1,25 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+class Dir;
+class FSNode;
+
+/* Live updates of the tree with inotify. Once init_watch is called, every
+ * directory read by the scanner is watched, and the changes reported by the
+ * kernel are applied to the tree by apply_watch_events.
+ */
+bool init_watch();
+void shutdown_watch();
+
+// called by the scanner threads for each directory, with an open fd to it
+bool watch_dir(Dir *dir, int fd);
+
+/* Reads the events reported so far, and applies them to the tree, which is
+ * then left for the caller to lay out again with Dir::relayout. Events are held back while
+ * background scans are running, so that nodes aren't freed under them. New
+ * directories are scanned with scan_async. Must be called by the thread which
+ * owns the tree. Returns true if the tree changed.
+ */
+bool apply_watch_events();
+
+#endif	// WATCH_H_